@@ -2,8 +2,24 @@
 #define TEST_HYPERCALLS_H
 
 
-#define INIT_SHARED_INFO 100
 #define INIT_START_INFO 101
 #define SET_BAREFLANK_TIME 102
+#define GET_SCRUB_STATS 103
+#define DUMP_EXIT_STATS 104
+#define GET_STATS_PAGE 105
+
+#define TRACE_OP 106
+#define TRACE_OP_GET_INFO 0
+#define TRACE_OP_ENABLE 1
+#define TRACE_OP_DISABLE 2
+
+#define FLUSH_LOG 107
+
+#define CAPTURE_OP 108
+#define CAPTURE_OP_START 0
+#define CAPTURE_OP_STOP 1
+#define CAPTURE_OP_READ 2
+
+#define DUMP_EXIT_SITES 109
 
 #endif
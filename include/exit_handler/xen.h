@@ -606,8 +606,6 @@ typedef struct shared_info {
 
 }shared_info_t;
 
-extern shared_info_t *shared_info;
-
 
 /*
  * Start-of-day memory layout
@@ -0,0 +1,154 @@
+#ifndef XEN_CAPTURE_H
+#define XEN_CAPTURE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#define XEN_CAPTURE_MAGIC 0x3150414358464200ULL /* "\0BFXCAP1" */
+#define XEN_CAPTURE_VERSION 1
+
+// Per-vCPU capture buffer size, and the room an exit must find left in it
+// to be captured at all, so that a captured exit is never cut short.
+#define XEN_CAPTURE_PAGES 256
+#define XEN_CAPTURE_EXIT_RESERVE (4 * 4096)
+
+#define XEN_CAPTURE_FLAG_TRUNCATED 1
+
+/*
+ * Capture log format. A log is a sequence of 8-byte aligned records, each
+ * starting with its type and total size. Every vCPU's log starts with a
+ * header record; logs of several vCPUs can be concatenated. Each exit
+ * record is followed by one memory record per guest mapping the handler
+ * made while handling it, holding the guest's bytes at the time of the
+ * mapping.
+ */
+enum xen_capture_type : uint32_t
+{
+    xen_capture_type_header = 1,
+    xen_capture_type_exit = 2,
+    xen_capture_type_mem = 3
+};
+
+enum xen_capture_reg
+{
+    xen_capture_rax, xen_capture_rbx, xen_capture_rcx, xen_capture_rdx,
+    xen_capture_rbp, xen_capture_rsi, xen_capture_rdi,
+    xen_capture_r08, xen_capture_r09, xen_capture_r10, xen_capture_r11,
+    xen_capture_r12, xen_capture_r13, xen_capture_r14, xen_capture_r15,
+    xen_capture_rip, xen_capture_rsp,
+    xen_capture_num_regs
+};
+
+struct xen_capture_rec
+{
+    uint32_t type;
+    uint32_t size;
+};
+
+struct xen_capture_header
+{
+    xen_capture_rec rec;
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint64_t vcpuid;
+};
+
+struct xen_capture_exit
+{
+    xen_capture_rec rec;
+    uint64_t tsc;
+    uint64_t reason;
+    uint64_t regs[xen_capture_num_regs];
+    uint64_t guest_cr3;
+    uint64_t guest_ia32_pat;
+};
+
+struct xen_capture_mem
+{
+    xen_capture_rec rec;
+    uint64_t gva;
+    uint64_t len;
+};
+
+#ifdef XEN_EXIT_CAPTURE
+
+/*
+ * Records this vCPU's exits while the domain's capture generation is odd.
+ * A new generation starts a new log. Only the owning vCPU appends; other
+ * vCPUs read up to the published length, which only ever grows within a
+ * generation. When the buffer fills, capture stops for the rest of the
+ * generation and the log is marked truncated.
+ */
+class xen_capture
+{
+public:
+
+    xen_capture(uint64_t vcpuid, const std::atomic<uint64_t> &generation);
+
+    bool enabled() const
+    { return (m_generation.load(std::memory_order_relaxed) & 1) != 0; }
+
+    bool active() const
+    { return m_active; }
+
+    void begin(uint64_t reason, const uint64_t (&regs)[xen_capture_num_regs], uint64_t cr3,
+               uint64_t pat);
+    void end()
+    { m_active = false; }
+
+    void record_memory(uint64_t gva, const void *data, uint64_t len);
+
+    uint64_t read(uint64_t offset, void *dst, uint64_t len) const;
+
+private:
+
+    void *reserve(xen_capture_type type, uint64_t size);
+    void truncate();
+
+    uint64_t m_vcpuid;
+    const std::atomic<uint64_t> &m_generation;
+
+    std::unique_ptr<uint8_t[]> m_buf;
+    std::atomic<uint64_t> m_len;
+    uint64_t m_log_generation;
+    bool m_active;
+    bool m_stopped;
+};
+
+#else
+
+class xen_capture
+{
+public:
+
+    xen_capture(uint64_t, const std::atomic<uint64_t> &)
+    { }
+
+    bool enabled() const
+    { return false; }
+
+    bool active() const
+    { return false; }
+
+    void begin(uint64_t, const uint64_t (&)[xen_capture_num_regs], uint64_t, uint64_t)
+    { }
+
+    void end()
+    { }
+
+    void record_memory(uint64_t, const void *, uint64_t)
+    { }
+
+    uint64_t read(uint64_t, void *, uint64_t) const
+    { return 0; }
+};
+
+#endif
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
@@ -0,0 +1,104 @@
+#ifndef XEN_CPUID_H
+#define XEN_CPUID_H
+
+#include <array>
+#include <cstdint>
+
+// Leaves cached from the basic (0x0) and extended (0x80000000) ranges, and
+// subleaves cached for each leaf that has them. Anything else goes to the
+// CPU as before.
+#define XEN_CPUID_BASIC_LEAVES 0x20U
+#define XEN_CPUID_EXTENDED_LEAVES 0x20U
+#define XEN_CPUID_SUBLEAVES 8U
+#define XEN_CPUID_CACHE_ENTRIES 192U
+
+#define XEN_CPUID_XSAVE_LEAF 0xDU
+
+#define CR4_OSXSAVE (1ULL << 18)
+#define CR4_PKE (1ULL << 22)
+#define CPUID_1_ECX_OSXSAVE (1U << 27)
+#define CPUID_7_ECX_OSPKE (1U << 4)
+
+struct xen_cpuid_result
+{
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+};
+
+/*
+ * One vCPU's CPUID results, read when the vCPU is made, on its own CPU, so
+ * the APIC ID and topology leaves are already that CPU's. Lookups are an
+ * index into a table of leaves and then into the results.
+ *
+ * The XSAVE leaf reports sizes for the features enabled in XCR0 and
+ * IA32_XSS, so it is read again after the guest's next xsetbv or IA32_XSS
+ * write. The OSXSAVE and OSPKE bits
+ * follow the guest's CR4 and are fixed up by the caller.
+ */
+class xen_cpuid_cache
+{
+public:
+
+    xen_cpuid_cache();
+
+    // nullptr if the leaf or subleaf is not cached.
+    const xen_cpuid_result *find(uint32_t leaf, uint32_t subleaf)
+    {
+        auto index = slot_index(leaf);
+
+        if (index >= m_slots.size())
+            return nullptr;
+
+        auto &&slot = m_slots[index];
+
+        if (!slot.indexed)
+            subleaf = 0;
+
+        if (subleaf >= slot.count)
+            return nullptr;
+
+        if (leaf == XEN_CPUID_XSAVE_LEAF && m_xsave_stale)
+            refill_xsave();
+
+        return &m_results[slot.first + subleaf];
+    }
+
+    void invalidate_xsave()
+    { m_xsave_stale = true; }
+
+private:
+
+    struct slot
+    {
+        uint8_t first;
+        uint8_t count;
+        bool indexed;
+    };
+
+    static uint32_t slot_index(uint32_t leaf)
+    {
+        if (leaf < XEN_CPUID_BASIC_LEAVES)
+            return leaf;
+
+        if (leaf - 0x80000000U < XEN_CPUID_EXTENDED_LEAVES)
+            return XEN_CPUID_BASIC_LEAVES + (leaf - 0x80000000U);
+
+        return ~0U;
+    }
+
+    void fill_range(uint32_t first_leaf);
+    void refill_xsave();
+
+    std::array<slot, XEN_CPUID_BASIC_LEAVES + XEN_CPUID_EXTENDED_LEAVES> m_slots;
+    std::array<xen_cpuid_result, XEN_CPUID_CACHE_ENTRIES> m_results;
+    uint32_t m_used;
+    bool m_xsave_stale;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
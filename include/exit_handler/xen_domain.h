@@ -0,0 +1,275 @@
+#ifndef XEN_DOMAIN_H
+#define XEN_DOMAIN_H
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <memory_manager/map_ptr_x64.h>
+#include <xen.h>
+#include <xen_evtchn.h>
+#include <xen_exit_stats.h>
+#include <xen_limits.h>
+#include <xen_msr.h>
+#include <xen_oprof.h>
+#include <xen_physmap.h>
+#include <xen_runstate.h>
+#include <xen_stats_page.h>
+#include <xen_tbuf.h>
+#include <xen_time.h>
+#include <xen_wait.h>
+
+#define XEN_START_INFO_MAGIC "xen-3.0-x86_64"
+
+#define XEN_STORE_EVTCHN 1
+#define XEN_CONSOLE_EVTCHN 2
+
+#define XEN_MAX_GRANT_FRAMES 32
+
+class xen_capture;
+
+/*
+ * Static description of the domain, supplied when the domain is created.
+ * Anything left at zero is reported to the guest as "not present".
+ */
+struct xen_domain_info
+{
+    unsigned long nr_pages = 0;
+    unsigned long max_pages = 0;
+    uint32_t flags = 0;
+    unsigned long mfn_list = 0;
+    unsigned long first_p2m_pfn = 0;
+    unsigned long nr_p2m_frames = 0;
+};
+
+/*
+ * Per-domain Xen state. There is one of these for the guest, shared by all
+ * of its vCPUs. The pages handed to the guest (shared_info, xenstore ring,
+ * console ring, grant table) stay mapped in the hypervisor for the life of
+ * the domain, so the exit handlers can access them without a page walk.
+ *
+ * Until the guest places shared_info with XENMEM_add_to_physmap it lives in
+ * a hypervisor-allocated frame. Once placed, the guest frame is mapped by
+ * physical address (no guest page walk), the current contents are carried
+ * over, and all further accesses go through that mapping until the guest
+ * takes the frame back with XENMEM_remove_from_physmap.
+ *
+ * The statistics page (see xen_stats_page.h) is always hypervisor-owned.
+ * The guest is told its machine address and maps it itself; vCPUs beyond
+ * XEN_STATS_PAGE_VCPUS count into a private entry that is never exposed.
+ */
+class xen_domain
+{
+public:
+
+    xen_domain(const xen_domain_info &info = xen_domain_info());
+
+    const start_info_t &start_info() const
+    { return m_start_info; }
+
+    shared_info_t *shared_info() const
+    { return __atomic_load_n(&m_shared_info, __ATOMIC_ACQUIRE); }
+
+    uintptr_t shared_info_maddr() const
+    { return m_shared_info_maddr; }
+
+    // A vCPU's vcpu_info is in shared_info until it registers its own,
+    // which is the only way for vCPUs beyond MAX_VIRT_CPUS to have one.
+    struct vcpu_info *vcpu_info(uint64_t vcpuid) const
+    {
+        if (vcpuid < XEN_MAX_VCPUS) {
+            auto info = __atomic_load_n(&m_vcpu_info[vcpuid], __ATOMIC_ACQUIRE);
+
+            if (info != nullptr)
+                return info;
+        }
+
+        return vcpuid < MAX_VIRT_CPUS ? &shared_info()->vcpu_info[vcpuid] : nullptr;
+    }
+
+    long register_vcpu_info(uint64_t vcpuid, xen_pfn_t gpfn, uint32_t offset);
+
+    // Publishes the time base, as of tsc, in the vCPU's vcpu_time_info.
+    void update_time(uint64_t vcpuid, uint64_t tsc);
+
+    long add_to_physmap(unsigned int space, xen_ulong_t idx, xen_pfn_t gpfn);
+    long remove_from_physmap(xen_pfn_t gpfn);
+
+    xen_physmap &physmap()
+    { return m_physmap; }
+
+    xen_evtchn &evtchn()
+    { return m_evtchn; }
+
+    xen_tbuf &tbuf()
+    { return m_tbuf; }
+
+    xen_oprof &oprof()
+    { return m_oprof; }
+
+    const xen_msr_bitmap &msr_bitmap() const
+    { return m_msr_bitmap; }
+
+    const xen_tsc_clock &clock() const
+    { return m_clock; }
+
+    // The VMX preemption timer's rate (see xen_oprof.h), which the vCPU
+    // factory reads from the hardware. At the default of 0 the timer is
+    // armed as if it counted TSC cycles, so it can only fire early.
+    uint64_t preemption_timer_rate() const
+    { return m_preemption_timer_rate; }
+
+    void set_preemption_timer_rate(uint64_t rate)
+    { m_preemption_timer_rate = rate; }
+
+    long vm_assist(unsigned long cmd, unsigned long type);
+
+    // HVM_PARAM_CALLBACK_IRQ, which only takes a vector (or 0, for none):
+    // there is no emulated interrupt controller to route a GSI or INTx.
+    long set_callback_irq(uint64_t val);
+    uint64_t callback_irq() const;
+
+    // The vector event channel upcalls are injected as, or 0.
+    uint8_t callback_vector() const
+    { return m_callback_vector.load(std::memory_order_relaxed); }
+
+    const std::atomic<bool> &runstate_update_flag() const
+    { return m_runstate_update_flag; }
+
+    void register_runstate(uint64_t vcpuid, xen_runstate *runstate)
+    {
+        if (vcpuid < XEN_MAX_VCPUS)
+            m_runstates[vcpuid] = runstate;
+    }
+
+    xen_runstate *runstate(uint64_t vcpuid) const
+    { return vcpuid < XEN_MAX_VCPUS ? m_runstates[vcpuid] : nullptr; }
+
+    void register_wait(uint64_t vcpuid, xen_wait *wait)
+    {
+        if (vcpuid < XEN_MAX_VCPUS)
+            m_waits[vcpuid] = wait;
+    }
+
+    // Records the wakeup of a vCPU blocked in SCHEDOP_block, for its
+    // latency, and kicks it out of the guest to see the event.
+    void wake(uint64_t vcpuid);
+
+    // How a blocked vCPU is kicked: an NMI to the CPU it runs on, which the
+    // vCPU factory sets up when the host's local APIC is in x2APIC mode.
+    // Each vCPU registers its CPU's APIC ID on its first exit. Without a
+    // kick a blocked vCPU looks for events every XEN_WAIT_SLICE_NS.
+    using kick_type = void (*)(uint32_t apic_id);
+
+    void set_kick(kick_type kick)
+    { m_kick = kick; }
+
+    bool kicks() const
+    { return m_kick != nullptr; }
+
+    void register_apic_id(uint64_t vcpuid, uint32_t apic_id)
+    {
+        if (vcpuid < XEN_MAX_VCPUS)
+            m_apic_ids[vcpuid] = apic_id;
+    }
+
+    // SCHEDOP_shutdown's reason, or -1 if the guest has not shut down.
+    long shutdown(unsigned int reason);
+
+    int shutdown_reason() const
+    { return m_shutdown_reason; }
+
+    // Builds the per-vCPU trace and profiling buffers for the first
+    // nr_vcpus vCPUs now, rather than as each one starts.
+    void prewarm(uint64_t nr_vcpus);
+
+    void register_exit_stats(uint64_t vcpuid, const xen_exit_stats *stats)
+    {
+        if (vcpuid < XEN_MAX_VCPUS)
+            m_exit_stats[vcpuid] = stats;
+    }
+
+    const xen_exit_stats *exit_stats(uint64_t vcpuid) const
+    { return vcpuid < XEN_MAX_VCPUS ? m_exit_stats[vcpuid] : nullptr; }
+
+    std::atomic<uint64_t> &capture_generation()
+    { return m_capture_generation; }
+
+    void register_capture(uint64_t vcpuid, const xen_capture *capture)
+    {
+        if (vcpuid < XEN_MAX_VCPUS)
+            m_captures[vcpuid] = capture;
+    }
+
+    const xen_capture *capture(uint64_t vcpuid) const
+    { return vcpuid < XEN_MAX_VCPUS ? m_captures[vcpuid] : nullptr; }
+
+    uintptr_t stats_page_maddr() const
+    { return m_stats_page_maddr; }
+
+    xen_stats_vcpu *stats_vcpu(uint64_t vcpuid);
+
+private:
+
+    void init_start_info(const xen_domain_info &info);
+
+    long map_shared_info(xen_pfn_t gpfn);
+    void publish_time(struct pvclock_vcpu_time_info &time, uint64_t tsc);
+    long map_grant_frame(xen_ulong_t idx, xen_pfn_t gpfn);
+
+    std::unique_ptr<uint8_t[]> m_shared_info_page;
+    std::unique_ptr<uint8_t[]> m_store_page;
+    std::unique_ptr<uint8_t[]> m_console_page;
+    std::unique_ptr<uint8_t[]> m_stats_page_mem;
+
+    shared_info_t *m_shared_info;
+    bfn::unique_map_ptr_x64<uint8_t> m_shared_info_map;
+    bfn::unique_map_ptr_x64<uint8_t> m_shared_info_retired;
+    std::array<bfn::unique_map_ptr_x64<uint8_t>, XEN_MAX_GRANT_FRAMES> m_grant_frames;
+    std::array<xen_pfn_t, XEN_MAX_GRANT_FRAMES> m_grant_gpfns{};
+
+    // Registered vcpu_info locations, and the permanent mappings of the
+    // pages they are in. The mutex makes each registration's check and
+    // publish one step.
+    std::mutex m_vcpu_info_mutex;
+    std::array<struct vcpu_info *, XEN_MAX_VCPUS> m_vcpu_info{};
+    std::array<bfn::unique_map_ptr_x64<uint8_t>, XEN_MAX_VCPUS> m_vcpu_info_maps;
+
+    uintptr_t m_shared_info_maddr;
+    uintptr_t m_store_maddr;
+    uintptr_t m_console_maddr;
+    uintptr_t m_stats_page_maddr;
+
+    xen_stats_page *m_stats_page;
+    xen_stats_vcpu m_stats_overflow;
+
+    start_info_t m_start_info;
+    xen_physmap m_physmap;
+    xen_evtchn m_evtchn;
+    xen_tbuf m_tbuf;
+    xen_oprof m_oprof;
+    xen_msr_bitmap m_msr_bitmap;
+    xen_tsc_clock m_clock;
+    uint64_t m_preemption_timer_rate = 0;
+
+    std::atomic<bool> m_runstate_update_flag{false};
+    std::atomic<uint8_t> m_callback_vector{0};
+    std::array<xen_runstate *, XEN_MAX_VCPUS> m_runstates{};
+
+    std::array<xen_wait *, XEN_MAX_VCPUS> m_waits{};
+    std::array<uint32_t, XEN_MAX_VCPUS> m_apic_ids{};
+    kick_type m_kick = nullptr;
+    std::atomic<int> m_shutdown_reason{-1};
+
+    std::array<const xen_exit_stats *, XEN_MAX_VCPUS> m_exit_stats{};
+
+    // Odd while exits are being captured; see xen_capture.h.
+    std::atomic<uint64_t> m_capture_generation{0};
+    std::array<const xen_capture *, XEN_MAX_VCPUS> m_captures{};
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
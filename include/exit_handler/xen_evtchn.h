@@ -0,0 +1,67 @@
+#ifndef XEN_EVTCHN_H
+#define XEN_EVTCHN_H
+
+#include <array>
+#include <mutex>
+#include <xen.h>
+#include <xen_event_channel.h>
+#include <xen_limits.h>
+
+// Ports addressable by the 2-level ABI on x86_64 (64 words of 64 bits).
+#define XEN_EVTCHN_PORTS (sizeof(xen_ulong_t) * 8 * sizeof(xen_ulong_t) * 8)
+
+class xen_domain;
+
+/*
+ * The domain's event channels, using the 2-level ABI in shared_info.
+ * Channels can be bound to VIRQs and IPIs; ports 1 and 2 are reserved for
+ * the xenstore and console rings advertised in start_info, which have no
+ * backend here, so sends on them are accepted and dropped.
+ *
+ * Raising a channel sets its pending bit and, if it is unmasked, the
+ * selector bit and evtchn_upcall_pending in the bound vCPU's vcpu_info,
+ * with the same atomic bit operations Xen uses. The guest finds the event
+ * the next time it scans its pending bits. A vCPU halted in SCHEDOP_block
+ * is kicked out of the guest to see it (see xen_domain::wake).
+ */
+class xen_evtchn
+{
+public:
+
+    xen_evtchn(xen_domain *domain);
+
+    long bind_virq(uint32_t virq, uint32_t vcpu, evtchn_port_t &port);
+    long bind_ipi(uint32_t vcpu, evtchn_port_t &port);
+    long close(evtchn_port_t port);
+    long send(evtchn_port_t port);
+    long unmask(evtchn_port_t port);
+
+    // Returns false if the guest has not bound the VIRQ on that vCPU.
+    bool raise_virq(uint32_t virq, uint64_t vcpu);
+
+private:
+
+    enum port_state : uint8_t { port_free, port_reserved, port_virq, port_ipi };
+
+    struct port_info
+    {
+        port_state state;
+        uint8_t virq;
+        uint32_t vcpu;
+    };
+
+    long alloc_port(port_state state, uint32_t virq, uint32_t vcpu, evtchn_port_t &port);
+    void set_pending(evtchn_port_t port, uint32_t vcpu);
+
+    xen_domain *m_domain;
+
+    std::mutex m_mutex;
+    std::array<port_info, XEN_EVTCHN_PORTS> m_ports;
+    std::array<std::array<evtchn_port_t, NR_VIRQS>, XEN_MAX_VCPUS> m_virq_ports;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
@@ -10,13 +10,22 @@
 #include <vmcs/vmcs_intel_x64_check.h>
 #include <vmcs/vmcs_intel_x64_debug.h>
 
+#include <atomic>
+#include <memory>
+#include <vcpuid.h>
 #include <exit_handler/exit_handler_intel_x64.h>
+#include <exit_handler/xen_capture.h>
+#include <exit_handler/xen_cpuid.h>
+#include <exit_handler/xen_domain.h>
+#include <exit_handler/xen_vmcs_cache.h>
+#include <exit_handler/xen_exit_stats.h>
+#include <exit_handler/xen_log.h>
+#include <exit_handler/xen_policy.h>
+#include <exit_handler/xen_timer.h>
 
 using namespace intel_x64;
 
 
-#define NANOSECONDS(delta) ((1000000ULL * delta) / tsc_khz)
-
 #define NSEC_PER_MSEC 1000000L
 #define NSEC_PER_SEC 1000000000ULL
 
@@ -24,6 +33,26 @@ using namespace intel_x64;
 #define XEN_CPUID_FIRST_LEAF 0x40000000
 #define XEN_CPUID_MAX_NUM_LEAVES 4
 
+// Extents and frames zeroed per memory_op exit before a continuation is
+// created (see xen_physmap.h), and how many extents are mapped from the
+// guest at a time (one page of pfns).
+#define XEN_MEMOP_PAGES_PER_EXIT 4096UL
+#define XEN_MEMOP_CHUNK (PAGE_SIZE / sizeof(xen_pfn_t))
+
+// mmuext_op operations handled per exit before a continuation is created.
+#define XEN_MMUEXT_OPS_PER_EXIT 64U
+
+// What sync_upcall and sync_nmi check and write to inject the callback
+// vector and the guest's NMIs.
+#define RFLAGS_IF (1ULL << 9)
+#define GUEST_INTERRUPTIBILITY_BLOCKING 0x3ULL
+#define GUEST_INTERRUPTIBILITY_NMI_BLOCKING 0xBULL
+#define VM_ENTRY_INTERRUPTION_VALID (1ULL << 31)
+#define VM_ENTRY_INTERRUPTION_EXTERNAL (0ULL << 8)
+#define VM_INTERRUPTION_TYPE_MASK (7ULL << 8)
+#define VM_INTERRUPTION_TYPE_NMI (2ULL << 8)
+#define VM_INTERRUPTION_VECTOR_NMI 2ULL
+
 uint64_t rdtsc(void);
 void init_hypercall_page(void *hypercall_page);
 
@@ -31,30 +60,186 @@ class xen_exit_handler : public exit_handler_intel_x64
 {
  public:
 
+    xen_exit_handler(vcpuid::type vcpuid, xen_domain *domain) :
+        m_vcpuid(vcpuid),
+        m_domain(domain),
+        m_stats(domain->stats_vcpu(vcpuid)),
+        m_trace(domain->tbuf().ring(vcpuid)),
+        m_oprof(domain->oprof().ring(vcpuid)),
+        m_capture(vcpuid, domain->capture_generation()),
+        m_runstate(domain->clock(), domain->runstate_update_flag()),
+        m_timers(domain->clock())
+    {
+        m_domain->register_exit_stats(m_vcpuid, &m_exit_stats);
+        m_domain->register_capture(m_vcpuid, &m_capture);
+        m_domain->register_runstate(m_vcpuid, &m_runstate);
+        m_domain->register_wait(m_vcpuid, &m_wait);
+    }
+
+    // Handlers are allocated from a pool reserved for the expected number
+    // of vCPUs (see xen_vcpu_pool.h), falling back to the heap.
+    static void reserve(size_t count);
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr);
 
     void handle_exit(intel_x64::vmcs::value_type reason) override;
 
+    template<class P>
+    void dispatch_exit(intel_x64::vmcs::value_type reason);
+
+    template<class P>
+    void resume_guest();
+
+    template<class P>
+    void prepare_entry();
+    void capture_exit(intel_x64::vmcs::value_type reason);
+
     void handle_xen_cpuid();
+    bool handle_cached_cpuid();
+
+    template<class P>
     void handle_xen_vmcall();
-    void handle_xen_wrmsr();
 
+    void handle_xen_wrmsr();
+    void wrmsr_hypercall_page(uint64_t val);
+    void start();
+    void handle_xen_hlt();
+    void sync_hlt_exiting();
+    void sync_nmi();
+    void sync_upcall();
+    void sync_oprof(uint64_t tsc);
+    void handle_xen_oprof_sample(uint64_t tsc);
+    void handle_xen_timers(uint64_t tsc);
+    void sync_preemption_timer(uint64_t tsc);
+
+    template<class P>
     void complete_xen_vmcall(ret_type ret, vmcall_registers_t &regs);
 
 
     void init_start_info(vmcall_registers_t &regs);
-    void init_shared_info(vmcall_registers_t &regs);
     void set_bareflank_time(vmcall_registers_t &regs);
+    long handle_set_timer_op(vmcall_registers_t &regs);
     void handle_vmcall_console_io(uintptr_t rdi, uintptr_t rsi, uintptr_t rdx);
     void handle_test_vmcall();
+    void get_scrub_stats(vmcall_registers_t &regs);
+    void dump_exit_stats(vmcall_registers_t &regs);
+    void dump_exit_sites(vmcall_registers_t &regs);
+    void get_stats_page(vmcall_registers_t &regs);
+    void trace_op(vmcall_registers_t &regs);
+    void flush_log();
+    void capture_op(vmcall_registers_t &regs);
 
 
     void handle_console_io_write(uintptr_t rsi, uintptr_t rdx);
     void handle_console_io_read();
 
+    long handle_memory_op(vmcall_registers_t &regs);
+    long memory_op_add_to_physmap(uintptr_t arg);
+    long memory_op_remove_from_physmap(uintptr_t arg);
+    long memory_op_reservation(vmcall_registers_t &regs);
+
+    long handle_mmuext_op(vmcall_registers_t &regs);
+    long do_mmuext_op(const mmuext_op &op);
+
+    long handle_event_channel_op(vmcall_registers_t &regs);
+
+    long handle_xenoprof_op(vmcall_registers_t &regs);
+
+    long handle_vcpu_op(vmcall_registers_t &regs);
+
+    long handle_hvm_op(vmcall_registers_t &regs);
+
+    long handle_sched_op(vmcall_registers_t &regs);
+    void block();
+    void end_block(intel_x64::vmcs::value_type reason, uint64_t tsc);
+
+    long hypercall_continuation(vmcall_registers_t &regs);
+
+    // Seqlock write of this vCPU's entry in the guest-visible statistics
+    // page. Only this vCPU writes it, so compiler barriers are enough.
+    template<class F>
+    void update_stats(F f)
+    {
+        m_stats->seq++;
+        std::atomic_signal_fence(std::memory_order_release);
+        f(*m_stats);
+        std::atomic_signal_fence(std::memory_order_release);
+        m_stats->seq++;
+    }
+
+    // Hides the base class's, which reads the instruction length from the
+    // VMCS every time.
+    void advance_rip()
+    { m_state_save->rip += m_vmcs_cache.exit_instruction_length(); }
+
+    bool tracing() const
+    { return m_trace != nullptr && m_trace->enabled(); }
+
+    template<class T>
+    auto map_guest(uintptr_t gva, size_t size = sizeof(T))
+    {
+        auto map = bfn::make_unique_map_x64<T>(gva, m_vmcs_cache.guest_cr3(), size,
+                                               m_vmcs_cache.guest_ia32_pat());
+
+        if (m_capture.active())
+            m_capture.record_memory(gva, map.get(), size);
+
+        return map;
+    }
+
+ private:
+
+    vcpuid::type m_vcpuid;
+    xen_domain *m_domain;
+    xen_stats_vcpu *m_stats;
+    xen_tbuf_ring *m_trace;
+    xen_oprof_ring *m_oprof;
+    xen_vmcs_cache m_vmcs_cache;
+    xen_cpuid_cache m_cpuid;
+    xen_exit_stats m_exit_stats;
+    xen_log_ring m_log;
+    xen_capture m_capture;
+    xen_runstate m_runstate;
+    xen_vcpu_timers m_timers;
+    xen_wait m_wait;
+    bool m_continuation = false;
+    bool m_hlt_exiting = false;
+    bool m_interrupt_window = false;
+    bool m_oprof_armed = false;
+    bool m_started = false;
+    bool m_nmi_pending = false;
+    bool m_nmi_window = false;
+    bool m_preemption_timer_armed = false;
+    bool m_blocked = false;
+    uint64_t m_oprof_deadline = 0;
+    uint64_t m_block_end = 0;
+
+    // Where the hypercall page was last written; all ones (never page
+    // aligned) until the guest first asks for it.
+    uint64_t m_hypercall_page = ~0ULL;
 
 };
 
+/*
+ * A handler with its features fixed at compile time by P (see
+ * xen_policy.h), so the checks for disabled features fold away. The plain
+ * xen_exit_handler is built with xen_default_policy.
+ */
+template<class P>
+class xen_exit_handler_t : public xen_exit_handler
+{
+ public:
+
+    using xen_exit_handler::xen_exit_handler;
+
+    void handle_exit(intel_x64::vmcs::value_type reason) override
+    { dispatch_exit<P>(reason); }
+};
 
+// Builds the xen_exit_handler_t for the given features. Defined in
+// xen_exit_handler.cpp, where every policy's dispatch_exit is instantiated.
+std::unique_ptr<xen_exit_handler>
+make_xen_exit_handler(vcpuid::type vcpuid, xen_domain *domain, const xen_features &features);
 
 #endif
 
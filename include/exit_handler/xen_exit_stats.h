@@ -0,0 +1,201 @@
+#ifndef XEN_EXIT_STATS_H
+#define XEN_EXIT_STATS_H
+
+#include <cstdint>
+
+#define XEN_EXIT_STATS_BUCKETS 32
+#define XEN_EXIT_STATS_REASONS 65
+#define XEN_EXIT_STATS_HYPERCALLS 64
+
+#define XEN_EXIT_SITES 512
+#define XEN_EXIT_SITES_PROBES 8
+#define XEN_EXIT_SITE_NO_HYPERCALL 0xFFFFFFFF
+#define XEN_EXIT_SITES_DUMP 16UL
+
+// Defined in xen_exit_handler.cpp
+uint64_t rdtsc(void);
+
+/*
+ * Cycle histogram for one kind of exit. Bucket n counts the exits that took
+ * [2^n, 2^(n+1)) cycles.
+ */
+struct xen_exit_histogram
+{
+    uint64_t count;
+    uint64_t total_cycles;
+    uint64_t max_cycles;
+    uint64_t buckets[XEN_EXIT_STATS_BUCKETS];
+
+    void record(uint64_t cycles)
+    {
+        auto bucket = 63 - __builtin_clzll(cycles | 1);
+
+        count++;
+        total_cycles += cycles;
+        max_cycles = cycles > max_cycles ? cycles : max_cycles;
+        buckets[bucket < XEN_EXIT_STATS_BUCKETS ? bucket : XEN_EXIT_STATS_BUCKETS - 1]++;
+    }
+};
+
+/*
+ * Raw per-vCPU statistics, as copied to the guest by DUMP_EXIT_STATS.
+ * Hypercalls above XEN_EXIT_STATS_HYPERCALLS - 1 (the private vmcalls) are
+ * all counted in the last slot.
+ */
+struct xen_exit_stats_data
+{
+    xen_exit_histogram reasons[XEN_EXIT_STATS_REASONS];
+    xen_exit_histogram hypercalls[XEN_EXIT_STATS_HYPERCALLS];
+};
+
+/*
+ * One guest exit site: the guest RIP an exit was taken at, its exit reason
+ * and, for vmcalls, the hypercall number. Copied to the guest, sorted by
+ * total cycles, by DUMP_EXIT_SITES.
+ */
+struct xen_exit_site
+{
+    uint64_t rip;
+    uint32_t reason;
+    uint32_t hypercall;
+    uint64_t count;
+    uint64_t total_cycles;
+};
+
+/*
+ * Bounded, open-addressed table of a vCPU's exit sites. A site whose probe
+ * sequence is full is only counted in dropped, so a guest exiting from
+ * many different addresses cannot grow the table.
+ */
+struct xen_exit_sites
+{
+    static_assert((XEN_EXIT_SITES & (XEN_EXIT_SITES - 1)) == 0, "XEN_EXIT_SITES must be a power of 2");
+
+    xen_exit_site sites[XEN_EXIT_SITES];
+    uint64_t dropped;
+
+    void record(uint64_t rip, uint32_t reason, uint32_t hypercall, uint64_t cycles)
+    {
+        auto key = rip ^ (static_cast<uint64_t>(reason) << 40) ^
+                   (static_cast<uint64_t>(hypercall) << 48);
+        auto index = (key * 0x9E3779B97F4A7C15ULL) >> 32;
+
+        for (auto probe = 0; probe < XEN_EXIT_SITES_PROBES; probe++) {
+            auto &&site = sites[(index + probe) & (XEN_EXIT_SITES - 1)];
+
+            if (site.count == 0) {
+                site.rip = rip;
+                site.reason = reason;
+                site.hypercall = hypercall;
+            }
+            else if (site.rip != rip || site.reason != reason || site.hypercall != hypercall) {
+                continue;
+            }
+
+            site.count++;
+            site.total_cycles += cycles;
+            return;
+        }
+
+        dropped++;
+    }
+};
+
+#ifdef XEN_EXIT_STATS
+
+/*
+ * Per-vCPU exit latency statistics. Each vCPU only ever writes its own
+ * instance, so the counters need no locking or atomics. Readers on other
+ * vCPUs may see a histogram that is one exit out of date.
+ */
+class xen_exit_stats
+{
+public:
+
+    xen_exit_stats() :
+        m_data(),
+        m_sites(),
+        m_start(0),
+        m_rip(0),
+        m_reason(0),
+        m_hypercall(-1),
+        m_site_reason(0),
+        m_site_hypercall(XEN_EXIT_SITE_NO_HYPERCALL)
+    { }
+
+    void begin(uint64_t reason, uint64_t rip)
+    {
+        m_start = rdtsc();
+        m_rip = rip;
+        m_reason = reason < XEN_EXIT_STATS_REASONS ? reason : XEN_EXIT_STATS_REASONS - 1;
+        m_hypercall = -1;
+        m_site_reason = static_cast<uint32_t>(reason);
+        m_site_hypercall = XEN_EXIT_SITE_NO_HYPERCALL;
+    }
+
+    void set_hypercall(uint64_t nr)
+    {
+        m_hypercall = nr < XEN_EXIT_STATS_HYPERCALLS ? nr : XEN_EXIT_STATS_HYPERCALLS - 1;
+        m_site_hypercall = static_cast<uint32_t>(nr);
+    }
+
+    void end()
+    {
+        auto cycles = rdtsc() - m_start;
+
+        m_data.reasons[m_reason].record(cycles);
+
+        if (m_hypercall >= 0)
+            m_data.hypercalls[m_hypercall].record(cycles);
+
+        m_sites.record(m_rip, m_site_reason, m_site_hypercall, cycles);
+    }
+
+    const xen_exit_stats_data *data() const
+    { return &m_data; }
+
+    const xen_exit_sites *sites() const
+    { return &m_sites; }
+
+private:
+
+    xen_exit_stats_data m_data;
+    xen_exit_sites m_sites;
+
+    uint64_t m_start;
+    uint64_t m_rip;
+    uint64_t m_reason;
+    int64_t m_hypercall;
+    uint32_t m_site_reason;
+    uint32_t m_site_hypercall;
+};
+
+#else
+
+class xen_exit_stats
+{
+public:
+
+    void begin(uint64_t, uint64_t)
+    { }
+
+    void set_hypercall(uint64_t)
+    { }
+
+    void end()
+    { }
+
+    const xen_exit_stats_data *data() const
+    { return nullptr; }
+
+    const xen_exit_sites *sites() const
+    { return nullptr; }
+};
+
+#endif
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
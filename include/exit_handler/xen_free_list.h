@@ -0,0 +1,110 @@
+#ifndef XEN_FREE_LIST_H
+#define XEN_FREE_LIST_H
+
+#include <cstddef>
+#include <new>
+
+/*
+ * Keeps freed blocks of one size for reuse, so that a node-based container
+ * that has reached its working size inserts and erases without going back
+ * to the VMM heap (and its global lock) on every exit. The size is taken
+ * from the first block freed; blocks of any other size go straight back to
+ * the heap. Not thread-safe: the owner's lock covers it.
+ */
+class xen_free_list
+{
+public:
+
+    xen_free_list() = default;
+    xen_free_list(const xen_free_list &) = delete;
+    xen_free_list &operator=(const xen_free_list &) = delete;
+
+    ~xen_free_list()
+    {
+        while (m_head != nullptr) {
+            auto next = m_head->next;
+            ::operator delete(m_head);
+            m_head = next;
+        }
+    }
+
+    void *alloc(size_t size)
+    {
+        if (m_head != nullptr && size == m_size) {
+            auto block = m_head;
+            m_head = block->next;
+            return block;
+        }
+
+        return ::operator new(size < sizeof(block) ? sizeof(block) : size);
+    }
+
+    void free(void *ptr, size_t size)
+    {
+        if (m_size == 0)
+            m_size = size;
+
+        if (size != m_size) {
+            ::operator delete(ptr);
+            return;
+        }
+
+        auto freed = static_cast<block *>(ptr);
+        freed->next = m_head;
+        m_head = freed;
+    }
+
+private:
+
+    struct block
+    {
+        block *next;
+    };
+
+    block *m_head = nullptr;
+    size_t m_size = 0;
+};
+
+template<class T>
+class xen_free_list_allocator
+{
+public:
+
+    using value_type = T;
+
+    explicit xen_free_list_allocator(xen_free_list *list) :
+        m_list(list)
+    { }
+
+    template<class U>
+    xen_free_list_allocator(const xen_free_list_allocator<U> &other) :
+        m_list(other.list())
+    { }
+
+    T *allocate(size_t n)
+    { return static_cast<T *>(m_list->alloc(n * sizeof(T))); }
+
+    void deallocate(T *ptr, size_t n)
+    { m_list->free(ptr, n * sizeof(T)); }
+
+    xen_free_list *list() const
+    { return m_list; }
+
+private:
+
+    xen_free_list *m_list;
+};
+
+template<class T, class U>
+bool operator==(const xen_free_list_allocator<T> &a, const xen_free_list_allocator<U> &b)
+{ return a.list() == b.list(); }
+
+template<class T, class U>
+bool operator!=(const xen_free_list_allocator<T> &a, const xen_free_list_allocator<U> &b)
+{ return a.list() != b.list(); }
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
@@ -47,6 +47,14 @@ namespace xen_hypercall {
     const int get_debugreg = 9;
     const int update_descriptor = 10;
     const int memory_op = 12;
+    namespace memory_op_cmd {
+        const int increase_reservation = 0;
+        const int decrease_reservation = 1;
+        const int populate_physmap = 6;
+        const int add_to_physmap = 7;
+        const int remove_from_physmap = 15;
+    }
+
     const int multicall = 13;
     const int update_va_mapping = 14;
     const int set_timer_op = 15;
@@ -0,0 +1,14 @@
+#ifndef XEN_LIMITS_H
+#define XEN_LIMITS_H
+
+// The most vCPUs a domain can have. Every vCPU up to this can register a
+// vcpu_info, be bound VIRQs and IPIs, and be profiled. Trace buffers are
+// limited further by their single t_info page (XEN_TBUF_MAX_VCPUS), and
+// the statistics page by its size (XEN_STATS_PAGE_VCPUS).
+#define XEN_MAX_VCPUS 256
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
@@ -0,0 +1,110 @@
+#ifndef XEN_LOG_H
+#define XEN_LOG_H
+
+#include <array>
+#include <cstdint>
+
+#define XEN_LOG_LEVEL_NONE 0
+#define XEN_LOG_LEVEL_ERROR 1
+#define XEN_LOG_LEVEL_WARN 2
+#define XEN_LOG_LEVEL_INFO 3
+#define XEN_LOG_LEVEL_DEBUG 4
+
+// Messages above this level are compiled out, arguments included.
+#ifndef XEN_LOG_LEVEL
+#define XEN_LOG_LEVEL XEN_LOG_LEVEL_INFO
+#endif
+
+#define XEN_LOG_RING_ENTRIES 256
+#define XEN_LOG_MAX_ARGS 4
+
+/*
+ * Message formats, indexing the table in xen_log.cpp. Formats take %x (hex)
+ * and %d (decimal) conversions of 64-bit arguments only.
+ */
+enum xen_log_fmt : uint16_t
+{
+    xen_log_cpuid_leaves,
+    xen_log_hypercall_page,
+    xen_log_console_io,
+    xen_log_console_read,
+    xen_log_test_vmcall,
+    xen_log_shutdown,
+    xen_log_num_formats
+};
+
+struct xen_log_entry
+{
+    uint64_t tsc;
+    uint16_t fmt;
+    uint8_t level;
+    uint8_t nr_args;
+    uint64_t args[XEN_LOG_MAX_ARGS];
+};
+
+uint64_t rdtsc(void);
+
+/*
+ * Per-vCPU deferred log. A message is recorded as its format id and raw
+ * arguments, and only turned into text by flush(), which is called at
+ * points where the guest is not waiting on the exit (the FLUSH_LOG vmcall
+ * and idle HLT exits). The ring is private to its vCPU; when it is full new
+ * messages are dropped and counted.
+ */
+class xen_log_ring
+{
+public:
+
+    template<class... Args>
+    void write(uint8_t level, xen_log_fmt fmt, Args... args)
+    {
+        static_assert(sizeof...(Args) <= XEN_LOG_MAX_ARGS, "too many log arguments");
+
+        if (m_head - m_tail == XEN_LOG_RING_ENTRIES) {
+            m_dropped++;
+            return;
+        }
+
+        auto &&entry = m_entries[m_head % XEN_LOG_RING_ENTRIES];
+        uint64_t argv[] = { static_cast<uint64_t>(args)..., 0 };
+
+        entry.tsc = rdtsc();
+        entry.fmt = fmt;
+        entry.level = level;
+        entry.nr_args = sizeof...(Args);
+
+        for (auto i = 0U; i < sizeof...(Args); i++)
+            entry.args[i] = argv[i];
+
+        m_head++;
+    }
+
+    bool empty() const
+    { return m_head == m_tail && m_dropped == 0; }
+
+    void flush(uint64_t vcpuid);
+
+private:
+
+    std::array<xen_log_entry, XEN_LOG_RING_ENTRIES> m_entries;
+    uint64_t m_head = 0;
+    uint64_t m_tail = 0;
+    uint64_t m_dropped = 0;
+};
+
+#define xen_log(level, fmt, ...) \
+    do { \
+        if ((level) <= XEN_LOG_LEVEL) \
+            m_log.write(level, fmt, ##__VA_ARGS__); \
+    } while (0)
+
+#define xen_log_error(fmt, ...) xen_log(XEN_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define xen_log_warn(fmt, ...) xen_log(XEN_LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define xen_log_info(fmt, ...) xen_log(XEN_LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define xen_log_debug(fmt, ...) xen_log(XEN_LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
@@ -0,0 +1,59 @@
+#ifndef XEN_MSR_H
+#define XEN_MSR_H
+
+#include <cstdint>
+#include <memory>
+
+// Xen's MSRs, from the base reported in CPUID leaf 0x40000002. Only the
+// hypercall page MSR exists.
+#define XEN_MSR_BASE 0x40000000U
+#define XEN_MSR_HYPERCALL_PAGE (XEN_MSR_BASE + 0)
+#define XEN_MSR_COUNT 1U
+
+// Writes to it change the XSAVE leaf, so always exit.
+#define MSR_IA32_XSS 0x00000DA0U
+
+/*
+ * The VMX MSR bitmap, one page shared by all of the domain's vCPUs. It has
+ * a read and a write bit for each MSR in the low (0 - 0x1FFF) and high
+ * (0xC0000000 - 0xC0001FFF) ranges, and a set bit makes that access exit.
+ * Accesses to MSRs outside both ranges, Xen's included, always exit. Every
+ * MSR traps to the base exit handler's emulation unless it is passed
+ * through here, which only the hot ones are: TSC deadline, x2APIC and the
+ * FS, GS and kernel GS bases. The rest may be backed by VMCS guest fields
+ * or be host state (the MTRRs, APIC base, feature control), so must exit.
+ */
+class xen_msr_bitmap
+{
+public:
+
+    xen_msr_bitmap();
+
+    void trap_read(uint32_t msr)
+    { set(msr, 0, true); }
+
+    void trap_write(uint32_t msr)
+    { set(msr, 2048, true); }
+
+    void pass_through(uint32_t msr)
+    {
+        set(msr, 0, false);
+        set(msr, 2048, false);
+    }
+
+    uintptr_t maddr() const
+    { return m_maddr; }
+
+private:
+
+    void set(uint32_t msr, uint32_t offset, bool trap);
+
+    std::unique_ptr<uint8_t[]> m_page;
+    uintptr_t m_maddr;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
@@ -0,0 +1,102 @@
+#ifndef XEN_OPROF_H
+#define XEN_OPROF_H
+
+#include <atomic>
+#include <array>
+#include <memory>
+#include <xen_limits.h>
+#include <xen_xenoprof.h>
+
+// The default and shortest sampling periods, in TSC cycles. The shortest
+// keeps a guest from being starved by its own profiler.
+#define XEN_OPROF_DEFAULT_PERIOD 1000000ULL
+#define XEN_OPROF_MIN_PERIOD 10000ULL
+
+// event_log.mode values, as oprofile's xenoprof driver reads them.
+#define XEN_OPROF_MODE_USER 0
+#define XEN_OPROF_MODE_KERNEL 1
+
+class xen_evtchn;
+
+// The VMX preemption timer counts down once every 2^rate TSC cycles, with
+// the rate read from IA32_VMX_MISC. Defined in xen_oprof.cpp
+uint64_t vmx_preemption_timer_rate(void);
+
+/*
+ * One vCPU's sample buffer: a one-page struct xenoprof_buf shared with the
+ * guest. The owning vCPU is the only producer and the guest only advances
+ * event_tail, so, as with the trace buffers, a sample is written first and
+ * published by the store to event_head. A sample that finds the buffer full
+ * is counted in lost_samples. VIRQ_XENOPROF is raised on the vCPU when the
+ * buffer becomes half full.
+ */
+class xen_oprof_ring
+{
+public:
+
+    xen_oprof_ring(uint64_t vcpuid, const std::atomic<bool> &virq, xen_evtchn &evtchn);
+
+    void sample(uint64_t rip, uint8_t mode);
+
+    uintptr_t maddr() const
+    { return m_maddr; }
+
+    uint32_t size() const
+    { return m_buf->event_size; }
+
+private:
+
+    uint64_t m_vcpuid;
+    const std::atomic<bool> &m_virq;
+    xen_evtchn &m_evtchn;
+
+    std::unique_ptr<uint8_t[]> m_page;
+    xenoprof_buf *m_buf;
+    uintptr_t m_maddr;
+    bool m_signalled;
+};
+
+/*
+ * The domain's profiler. Samples are taken with the VMX preemption timer,
+ * which each vCPU arms on its next exit once profiling is started and
+ * disarms once it is stopped, so starting and stopping never has to reach
+ * into another vCPU's VMCS.
+ */
+class xen_oprof
+{
+public:
+
+    xen_oprof(xen_evtchn &evtchn);
+
+    xen_oprof_ring *ring(uint64_t vcpuid);
+
+    bool running() const
+    { return m_running.load(std::memory_order_relaxed); }
+
+    uint64_t period() const
+    { return m_period; }
+
+    long set_period(uint64_t period);
+    long start();
+
+    void stop()
+    { m_running = false; }
+
+    void enable_virq(bool enabled)
+    { m_virq = enabled; }
+
+private:
+
+    xen_evtchn &m_evtchn;
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_virq;
+    uint64_t m_period;
+
+    std::array<std::unique_ptr<xen_oprof_ring>, XEN_MAX_VCPUS> m_rings;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
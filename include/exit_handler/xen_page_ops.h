@@ -0,0 +1,43 @@
+#ifndef XEN_PAGE_OPS_H
+#define XEN_PAGE_OPS_H
+
+#include <cstddef>
+
+/*
+ * Whole-page clear and copy kernels, picked at runtime from what the CPU
+ * (and the XCR0 the host OS set up) supports.
+ *
+ * The temporal kernels are for pages the guest is about to use, e.g.
+ * MMUEXT_CLEAR_PAGE / MMUEXT_COPY_PAGE. The non-temporal ones bypass the
+ * cache and are for pages nobody will touch soon, e.g. scrubbing ballooned
+ * frames.
+ *
+ * The exit path does not save the guest's vector registers, so the SIMD
+ * kernels save and restore the few registers they use (at full ZMM width
+ * when the OS has enabled AVX-512 state) around the loop.
+ */
+struct xen_page_kernel
+{
+    const char *name;
+    bool non_temporal;
+    bool (*supported)();
+    void (*clear)(void *dst);
+    void (*copy)(void *dst, const void *src);
+};
+
+extern const xen_page_kernel g_page_kernels[];
+extern const size_t g_nr_page_kernels;
+
+const xen_page_kernel *select_page_kernel(bool non_temporal);
+
+void clear_page(void *dst);
+void copy_page(void *dst, const void *src);
+
+void clear_page_nt(void *dst);
+void copy_page_nt(void *dst, const void *src);
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
@@ -0,0 +1,97 @@
+#ifndef XEN_PHYSMAP_H
+#define XEN_PHYSMAP_H
+
+#include <atomic>
+#include <mutex>
+#include <xen.h>
+#include <xen_range_set.h>
+
+// A 1G superpage. An extent with more frames to zero than one exit's
+// budget has them zeroed over several.
+#define XEN_MAX_EXTENT_ORDER 18
+
+// Frames zeroed per idle (HLT) exit by the background scrubber.
+#define XEN_SCRUB_BATCH_PAGES 64
+
+struct xen_scrub_stats
+{
+    unsigned long queued_pages;
+    unsigned long clean_pages;
+    unsigned long scrubbed_pages;
+    unsigned long sync_pages;
+    uint64_t scrub_cycles;
+};
+
+/*
+ * Tracks which parts of the guest's pseudo-physical address space are
+ * backed by memory. Without EPT a gpfn is also the machine frame, so
+ * ballooning does not move memory around: a released extent is simply
+ * recorded, and populating it again takes it back.
+ *
+ * Released frames must be zeroed before the guest gets them back. They go
+ * onto a dirty queue that is scrubbed in the background from idle vCPUs
+ * (see scrub()), and once zeroed they move to a clean pool. Populating a
+ * clean frame costs nothing; only frames the guest asks for before the
+ * scrubber reached them are zeroed synchronously. increase_reservation
+ * draws from the clean pool first.
+ *
+ * All of the extent operations take a batch of extents and return how
+ * many were completed. They stop at the first extent that fails, or when
+ * budget, which each extent and each frame zeroed synchronously take one
+ * from, runs out. An extent is only completed once it fits in what is left;
+ * until then the budget goes on zeroing its dirty frames, which the next
+ * call finds clean, so the caller can go on in a continuation.
+ */
+class xen_physmap
+{
+public:
+
+    xen_physmap(unsigned long tot_pages, unsigned long max_pages);
+
+    unsigned long populate(xen_pfn_t *extents, unsigned long count, unsigned int order,
+                           unsigned long &budget);
+    unsigned long release(xen_pfn_t *extents, unsigned long count, unsigned int order,
+                          unsigned long &budget);
+    unsigned long reclaim(xen_pfn_t *extents, unsigned long count, unsigned int order,
+                          unsigned long &budget);
+
+    bool is_populated(xen_pfn_t gpfn);
+
+    bool scrub_pending() const
+    { return m_scrub_pending.load(std::memory_order_relaxed); }
+
+    unsigned long scrub(unsigned long budget);
+    xen_scrub_stats scrub_stats();
+
+    unsigned long tot_pages() const
+    { return m_tot_pages; }
+
+    unsigned long max_pages() const
+    { return m_max_pages; }
+
+private:
+
+    unsigned long released(xen_pfn_t start, xen_pfn_t end) const;
+    bool find_released(unsigned int order, xen_pfn_t &gpfn) const;
+    bool fits(xen_pfn_t start, xen_pfn_t end, unsigned long &budget);
+    unsigned long take(xen_pfn_t start, xen_pfn_t end);
+    void zero_frames(xen_pfn_t start, xen_pfn_t end);
+
+    std::mutex m_mutex;
+    xen_range_set m_dirty;
+    xen_range_set m_clean;
+    std::atomic<bool> m_scrub_pending;
+
+    unsigned long m_tot_pages;
+    unsigned long m_max_pages;
+
+    unsigned long m_scrubbed_pages;
+    unsigned long m_sync_pages;
+    uint64_t m_scrub_cycles;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
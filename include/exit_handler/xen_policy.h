@@ -0,0 +1,54 @@
+#ifndef XEN_POLICY_H
+#define XEN_POLICY_H
+
+enum class xen_console_mode
+{
+    debug_ring,
+    discard
+};
+
+/*
+ * The features a xen_exit_handler_t is built with. Each is a constant, so a
+ * handler built without a feature has no check for it on the exit path:
+ *
+ * - pvclock: SET_BAREFLANK_TIME updates the shared_info time, and vCPU
+ *   runstate time is accounted.
+ * - event_channels: event_channel_op is handled, as is hvm_op for the
+ *   callback vector that upcalls are injected as.
+ * - tracing: exits and hypercalls are recorded when the guest enables
+ *   tracing with TRACE_OP, and xenoprof_op samples guest RIPs.
+ * - console: where console_io writes go.
+ *
+ * The vCPU timers (set_timer_op and the VCPUOP timers) count in pvclock
+ * time and fire as VIRQ_TIMER, so they come with pvclock and event
+ * channels together.
+ *
+ * A disabled hypercall fails with -ENOSYS, as an unknown one would.
+ */
+template<bool Pvclock, bool EventChannels, bool Tracing, xen_console_mode Console>
+struct xen_policy
+{
+    static constexpr const bool pvclock = Pvclock;
+    static constexpr const bool event_channels = EventChannels;
+    static constexpr const bool tracing = Tracing;
+    static constexpr const xen_console_mode console = Console;
+    static constexpr const bool timers = Pvclock && EventChannels;
+};
+
+using xen_default_policy = xen_policy<true, true, true, xen_console_mode::debug_ring>;
+
+// The same features chosen at run time, which make_xen_exit_handler turns
+// into the matching xen_policy.
+struct xen_features
+{
+    bool pvclock = true;
+    bool event_channels = true;
+    bool tracing = true;
+    xen_console_mode console = xen_console_mode::debug_ring;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
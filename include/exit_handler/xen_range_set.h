@@ -0,0 +1,197 @@
+#ifndef XEN_RANGE_SET_H
+#define XEN_RANGE_SET_H
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <xen.h>
+#include <xen_free_list.h>
+
+/*
+ * A set of page frames stored as coalesced [start, end) ranges. Used for the
+ * guest memory the domain has given back, where extents of up to 1 GiB are
+ * common and one entry per page would be far too big. Map nodes are
+ * recycled through a free list, so a set that has reached its working size
+ * does not allocate.
+ */
+class xen_range_set
+{
+    using range_map = std::map<xen_pfn_t, xen_pfn_t, std::less<xen_pfn_t>,
+                               xen_free_list_allocator<std::pair<const xen_pfn_t, xen_pfn_t>>>;
+
+public:
+
+    xen_range_set() :
+        m_ranges(range_map::allocator_type(&m_free_list))
+    { }
+
+    xen_range_set(const xen_range_set &) = delete;
+    xen_range_set &operator=(const xen_range_set &) = delete;
+
+    unsigned long pages() const
+    { return m_pages; }
+
+    bool empty() const
+    { return m_pages == 0; }
+
+    // Number of frames in [start, end) that are in the set.
+    unsigned long count(xen_pfn_t start, xen_pfn_t end) const
+    {
+        auto pages = 0UL;
+
+        for (auto iter = first_overlap(start); iter != m_ranges.end() && iter->first < end; ++iter) {
+            if (iter->second > start)
+                pages += std::min(iter->second, end) - std::max(iter->first, start);
+        }
+
+        return pages;
+    }
+
+    // Adds [start, end), merging with its neighbours. Returns how many frames
+    // were not in the set before.
+    unsigned long insert(xen_pfn_t start, xen_pfn_t end)
+    {
+        auto len = end - start;
+        auto pages = len - remove(start, end);
+
+        m_pages += len;
+
+        auto next = m_ranges.find(end);
+        if (next != m_ranges.end()) {
+            end = next->second;
+            m_ranges.erase(next);
+        }
+
+        auto iter = m_ranges.lower_bound(start);
+        if (iter != m_ranges.begin()) {
+            auto prev = std::prev(iter);
+
+            if (prev->second == start) {
+                prev->second = end;
+                return pages;
+            }
+        }
+
+        m_ranges[start] = end;
+        return pages;
+    }
+
+    // Removes [start, end), calling removed(a, b) for every piece [a, b) that
+    // was actually in the set. Returns how many frames were removed.
+    template<class F>
+    unsigned long remove(xen_pfn_t start, xen_pfn_t end, F removed)
+    {
+        auto pages = 0UL;
+        auto iter = first_overlap(start);
+
+        while (iter != m_ranges.end() && iter->first < end) {
+            auto r_start = iter->first;
+            auto r_end = iter->second;
+
+            if (r_end <= start) {
+                ++iter;
+                continue;
+            }
+
+            iter = m_ranges.erase(iter);
+
+            if (r_start < start)
+                m_ranges[r_start] = start;
+
+            if (r_end > end)
+                m_ranges[end] = r_end;
+
+            removed(std::max(r_start, start), std::min(r_end, end));
+            pages += std::min(r_end, end) - std::max(r_start, start);
+        }
+
+        m_pages -= pages;
+        return pages;
+    }
+
+    unsigned long remove(xen_pfn_t start, xen_pfn_t end)
+    { return remove(start, end, [](xen_pfn_t, xen_pfn_t) { }); }
+
+    // Finds a naturally aligned block of 2^order frames that is entirely in
+    // the set.
+    bool find_aligned(unsigned int order, xen_pfn_t &gpfn) const
+    {
+        auto nr = 1UL << order;
+
+        for (const auto &range : m_ranges) {
+            auto aligned = (range.first + nr - 1) & ~(nr - 1);
+
+            if (aligned + nr <= range.second) {
+                gpfn = aligned;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Finds the first piece [a, b) of the set within [start, end).
+    bool first_in(xen_pfn_t start, xen_pfn_t end, xen_pfn_t &a, xen_pfn_t &b) const
+    {
+        for (auto iter = first_overlap(start); iter != m_ranges.end() && iter->first < end; ++iter) {
+            if (iter->second > start) {
+                a = std::max(iter->first, start);
+                b = std::min(iter->second, end);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    range_map::const_iterator begin() const
+    { return m_ranges.begin(); }
+
+    range_map::const_iterator end() const
+    { return m_ranges.end(); }
+
+    // Takes up to max frames off the front of the set.
+    bool pop(unsigned long max, xen_pfn_t &start, xen_pfn_t &end)
+    {
+        if (m_ranges.empty())
+            return false;
+
+        start = m_ranges.begin()->first;
+        end = std::min(m_ranges.begin()->second, start + max);
+
+        remove(start, end);
+        return true;
+    }
+
+private:
+
+    range_map::const_iterator first_overlap(xen_pfn_t start) const
+    {
+        auto iter = m_ranges.upper_bound(start);
+
+        if (iter != m_ranges.begin())
+            --iter;
+
+        return iter;
+    }
+
+    range_map::iterator first_overlap(xen_pfn_t start)
+    {
+        auto iter = m_ranges.upper_bound(start);
+
+        if (iter != m_ranges.begin())
+            --iter;
+
+        return iter;
+    }
+
+    xen_free_list m_free_list;
+    range_map m_ranges;
+    unsigned long m_pages = 0;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
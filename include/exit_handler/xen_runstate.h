@@ -0,0 +1,96 @@
+#ifndef XEN_RUNSTATE_H
+#define XEN_RUNSTATE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <memory_manager/map_ptr_x64.h>
+#include <xen_time.h>
+#include <xen_vcpu.h>
+
+/*
+ * One vCPU's runstate accounting, kept in TSC cycles and converted to
+ * nanoseconds when read. The vCPU is running while in the guest. Time in
+ * the hypervisor counts as runnable (it is what the guest sees as steal
+ * time), except during HLT exits and SCHEDOP_block, when the guest was
+ * idle anyway and it counts as blocked. A vCPU is offline until its first
+ * exit. The owning vCPU bumps a sequence count around each change, so
+ * another vCPU reading it with VCPUOP_get_runstate_info retries rather than
+ * see a torn snapshot.
+ *
+ * If the guest has registered a runstate area it is written on every VM
+ * entry, as Xen does when it schedules a vCPU. The owning vCPU is the only
+ * writer, and compiler barriers order the writes on x86. An area may be
+ * registered from any vCPU, so it is handed over and only taken up, and
+ * the old one released, by the owning vCPU on its next entry. With
+ * VMASST_TYPE_runstate_update_flag the update is bracketed by
+ * XEN_RUNSTATE_UPDATE in state_entry_time so that readers can retry.
+ */
+class xen_runstate
+{
+public:
+
+    xen_runstate(const xen_tsc_clock &clock, const std::atomic<bool> &update_flag);
+
+    void exit(uint64_t tsc, bool idle)
+    { change(idle ? RUNSTATE_blocked : RUNSTATE_runnable, tsc); }
+
+    void block(uint64_t tsc)
+    { change(RUNSTATE_blocked, tsc); }
+
+    void enter(uint64_t tsc)
+    {
+        change(RUNSTATE_running, tsc);
+
+        if (m_pending.load(std::memory_order_acquire))
+            take_area();
+
+        if (m_area_map.get() != nullptr)
+            publish();
+    }
+
+    vcpu_runstate_info info() const;
+
+    // Hands the guest's area, mapped for good, to the owning vCPU.
+    void register_area(bfn::unique_map_ptr_x64<vcpu_runstate_info> &&map);
+
+private:
+
+    void change(int state, uint64_t tsc)
+    {
+        __atomic_store_n(&m_seq, m_seq + 1, __ATOMIC_RELAXED);
+        std::atomic_signal_fence(std::memory_order_release);
+
+        if (m_entry_tsc != 0)
+            m_cycles[m_state] += tsc - m_entry_tsc;
+
+        m_state = state;
+        m_entry_tsc = tsc;
+
+        std::atomic_signal_fence(std::memory_order_release);
+        __atomic_store_n(&m_seq, m_seq + 1, __ATOMIC_RELAXED);
+    }
+
+    void take_area();
+    void publish();
+
+    const xen_tsc_clock &m_clock;
+    const std::atomic<bool> &m_update_flag;
+
+    uint64_t m_seq;
+    int m_state;
+    uint64_t m_entry_tsc;
+    uint64_t m_cycles[4];
+
+    bfn::unique_map_ptr_x64<vcpu_runstate_info> m_area_map;
+
+    std::mutex m_pending_mutex;
+    std::atomic<bool> m_pending;
+    bfn::unique_map_ptr_x64<vcpu_runstate_info> m_pending_map;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
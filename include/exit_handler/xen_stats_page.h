@@ -0,0 +1,56 @@
+#ifndef XEN_STATS_PAGE_H
+#define XEN_STATS_PAGE_H
+
+/*
+ * Layout of the per-domain statistics page. This header is shared with the
+ * guest drivers in test_drivers/, so it must stay plain C.
+ *
+ * Each vCPU only ever updates its own entry, bracketing the update with
+ * seq increments (odd while an update is in progress). A reader copies the
+ * entry and retries if seq was odd or changed:
+ *
+ *     do {
+ *         seq = READ_ONCE(entry->seq);
+ *         smp_rmb();
+ *         copy = *entry;
+ *         smp_rmb();
+ *     } while ((seq & 1) || seq != READ_ONCE(entry->seq));
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define XEN_STATS_PAGE_MAGIC 0x5354415453584642ULL /* "BFXSTATS" */
+#define XEN_STATS_PAGE_VERSION 1
+#define XEN_STATS_PAGE_VCPUS 63
+
+struct xen_stats_vcpu
+{
+    uint32_t seq;
+    uint32_t pad;
+    uint64_t exits;
+    uint64_t hypercalls;
+    uint64_t event_sends;
+    uint64_t time_updates;
+    uint64_t blocks;
+    uint64_t wakeups;
+    uint64_t wake_latency_ns;   /* total, over all wakeups */
+};
+
+struct xen_stats_page
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t nr_vcpus;
+    uint64_t reserved[6];
+    struct xen_stats_vcpu vcpu[XEN_STATS_PAGE_VCPUS];
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
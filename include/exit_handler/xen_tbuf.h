@@ -0,0 +1,100 @@
+#ifndef XEN_TBUF_H
+#define XEN_TBUF_H
+
+#include <atomic>
+#include <array>
+#include <memory>
+#include <xen_trace.h>
+
+// Pages per vCPU trace buffer, and how many vCPUs can be traced (all of
+// their page lists have to fit in the single t_info page).
+#define XEN_TBUF_PAGES 8
+#define XEN_TBUF_MAX_VCPUS 64
+
+// Xen has no event for hypercall return values. They are recorded as
+// {op, ret_lo, ret_hi} in the guest class, which xenalyze passes over.
+#define XEN_TRC_HYPERCALL_RESULT (TRC_GUEST + 1)
+
+class xen_evtchn;
+
+/*
+ * One vCPU's trace buffer, in the xentrace layout: a struct t_buf header
+ * followed by variable-size t_rec records, with cons/prod running modulo
+ * twice the data size. The owning vCPU is the only producer and the guest
+ * consumer only advances cons, so no locking is needed: records are written
+ * first and published by the store to prod.
+ *
+ * If a record does not fit it is dropped and counted, and a
+ * TRC_LOST_RECORDS record is written as soon as there is room again. The
+ * consumer is notified with VIRQ_TBUF when the buffer becomes half full.
+ */
+class xen_tbuf_ring
+{
+public:
+
+    xen_tbuf_ring(uint64_t vcpuid, const std::atomic<bool> &enabled, xen_evtchn &evtchn);
+
+    bool enabled() const
+    { return m_enabled.load(std::memory_order_relaxed); }
+
+    void record(uint32_t event, const uint32_t *extra, uint32_t nr_extra);
+
+    uintptr_t page_maddr(unsigned int page) const;
+
+private:
+
+    bool insert(uint32_t event, const uint32_t *extra, uint32_t nr_extra, bool cycles);
+    void write(uint32_t event, const uint32_t *extra, uint32_t nr_extra, bool cycles);
+    uint32_t unconsumed() const;
+
+    uint64_t m_vcpuid;
+    const std::atomic<bool> &m_enabled;
+    xen_evtchn &m_evtchn;
+
+    std::unique_ptr<uint8_t[]> m_pages;
+    t_buf *m_buf;
+    uint8_t *m_data;
+    uint32_t m_data_size;
+
+    uint32_t m_lost;
+    uint64_t m_first_lost_tsc;
+    bool m_signalled;
+};
+
+/*
+ * The domain's trace buffers. The t_info page lists every buffer's frames
+ * the way Xen's XEN_SYSCTL_TBUFOP_get_info does, so a xentrace-style
+ * consumer can map them and write out a file xenalyze understands.
+ */
+class xen_tbuf
+{
+public:
+
+    xen_tbuf(xen_evtchn &evtchn);
+
+    xen_tbuf_ring *ring(uint64_t vcpuid);
+
+    void enable(bool enabled)
+    { m_enabled = enabled; }
+
+    uintptr_t t_info_maddr() const
+    { return m_t_info_maddr; }
+
+private:
+
+    xen_evtchn &m_evtchn;
+    std::atomic<bool> m_enabled;
+
+    std::unique_ptr<uint8_t[]> m_t_info_page;
+    t_info *m_t_info;
+    uintptr_t m_t_info_maddr;
+    uint16_t m_next_offset;
+
+    std::array<std::unique_ptr<xen_tbuf_ring>, XEN_TBUF_MAX_VCPUS> m_rings;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
@@ -0,0 +1,53 @@
+#ifndef XEN_TIME_H
+#define XEN_TIME_H
+
+#include <cstdint>
+
+// Used when CPUID reports no TSC frequency.
+#define XEN_TSC_DEFAULT_KHZ 1000000ULL
+
+/*
+ * Converts between TSC cycles and nanoseconds, with factors worked out
+ * once from the TSC frequency in CPUID leaf 0x15 (or the base frequency
+ * in 0x16). System time, as the hypervisor reports it in runstate areas
+ * and takes it in timer hypercalls, is the TSC in nanoseconds. It is
+ * scaled with the same tsc_to_system_mul and tsc_shift that are published
+ * in vcpu_time_info, so a guest's pvclock reads the same time base.
+ */
+class xen_tsc_clock
+{
+public:
+
+    xen_tsc_clock();
+
+    uint64_t khz() const
+    { return m_khz; }
+
+    uint32_t tsc_to_system_mul() const
+    { return m_mul; }
+
+    int8_t tsc_shift() const
+    { return m_shift; }
+
+    uint64_t ns(uint64_t tsc) const
+    {
+        tsc = m_shift < 0 ? tsc >> -m_shift : tsc << m_shift;
+        return static_cast<uint64_t>((static_cast<unsigned __int128>(tsc) * m_mul) >> 32);
+    }
+
+    uint64_t tsc(uint64_t ns) const
+    { return static_cast<uint64_t>((static_cast<unsigned __int128>(ns) * m_tsc_per_ns) >> 32); }
+
+private:
+
+    uint64_t m_khz;
+    uint32_t m_mul;
+    int8_t m_shift;
+    uint64_t m_tsc_per_ns;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
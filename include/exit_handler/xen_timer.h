@@ -0,0 +1,168 @@
+#ifndef XEN_TIMER_H
+#define XEN_TIMER_H
+
+#include <cstdint>
+#include <xen_time.h>
+
+// Expiries this close together are handled on the same exit, as with
+// Xen's default timer_slop.
+#define XEN_TIMER_SLOP_NS 50000ULL
+
+// The shortest period VCPUOP_set_periodic_timer accepts, as in Xen.
+#define XEN_TIMER_MIN_PERIOD_NS 1000000ULL
+
+// Timeouts further out than this are brought in to it, as Xen does for
+// set_timer_op, which some guests call with garbage in the top bits.
+#define XEN_TIMER_MAX_NS (1ULL << 50)
+
+// Four levels of 64 slots reach 2^24 ticks ahead (about 14 minutes with
+// 50us ticks); anything further waits in the last level and is placed
+// again each time it is cascaded.
+#define XEN_TIMER_LEVELS 4U
+#define XEN_TIMER_SLOT_BITS 6U
+#define XEN_TIMER_SLOTS (1U << XEN_TIMER_SLOT_BITS)
+
+struct xen_timer
+{
+    uint64_t tick = 0;
+    xen_timer *next = nullptr;
+    xen_timer **pprev = nullptr;
+    uint32_t level = 0;
+    uint32_t slot = 0;
+
+    bool pending() const
+    { return pprev != nullptr; }
+};
+
+/*
+ * A hierarchical timer wheel in TSC ticks of 2^shift cycles. Each timer is
+ * linked into one slot, so setting and cancelling one are O(1). Level 0
+ * holds timers due in the next 64 ticks, one tick per slot; each level
+ * above holds 64 times the span of the one below, and its slots are
+ * cascaded down as the wheel reaches them.
+ *
+ * Expiries are rounded up to a tick, so timers never fire early and those
+ * due within a tick of each other fire together. expire() jumps straight
+ * from one occupied slot to the next, so an idle wheel costs nothing to
+ * catch up. Not thread-safe: the wheel belongs to one vCPU.
+ */
+class xen_timer_wheel
+{
+public:
+
+    explicit xen_timer_wheel(uint64_t tick_cycles);
+
+    xen_timer_wheel(const xen_timer_wheel &) = delete;
+    xen_timer_wheel &operator=(const xen_timer_wheel &) = delete;
+
+    // Moves the timer if it is already pending.
+    void set(xen_timer &timer, uint64_t expires, uint64_t tsc);
+    void cancel(xen_timer &timer);
+
+    // Unlinks each timer due by tsc and passes it to fire, which may set
+    // it again for a time after tsc.
+    template<class F>
+    void expire(uint64_t tsc, F fire)
+    {
+        auto now = tsc >> m_shift;
+
+        // m_now stops at now rather than passing it, so a timer set later
+        // for a tick that has been handled still finds it.
+        while (true) {
+            auto next = next_tick();
+
+            if (next > now) {
+                if (m_now < now)
+                    m_now = now;
+
+                break;
+            }
+
+            m_now = next;
+            cascade();
+
+            auto due = take(0, m_now & (XEN_TIMER_SLOTS - 1));
+            auto done = m_now == now;
+
+            if (!done)
+                m_now++;
+
+            while (due != nullptr) {
+                auto timer = due;
+                due = timer->next;
+
+                timer->next = nullptr;
+                timer->pprev = nullptr;
+                fire(*timer);
+            }
+
+            if (done)
+                break;
+        }
+
+        update_deadline();
+    }
+
+    // The TSC value by which expire() has a timer to fire, or ~0 if none
+    // are pending.
+    uint64_t deadline() const
+    { return m_deadline; }
+
+private:
+
+    bool empty() const;
+    void place(xen_timer &timer);
+    void cascade();
+    xen_timer *take(uint32_t level, uint32_t slot);
+    uint32_t first_slot(uint32_t level, uint64_t &tick) const;
+    uint64_t next_tick() const;
+    void update_deadline();
+
+    uint64_t m_shift;
+    uint64_t m_now;
+    uint64_t m_deadline;
+    uint64_t m_occupied[XEN_TIMER_LEVELS];
+    xen_timer *m_slots[XEN_TIMER_LEVELS][XEN_TIMER_SLOTS];
+};
+
+/*
+ * A vCPU's two Xen timers, both of which raise VIRQ_TIMER: the single-shot
+ * timer (set_timer_op and VCPUOP_set_singleshot_timer) and the periodic
+ * timer. Timeouts and periods are in system time nanoseconds, and tsc is
+ * the current TSC. A timeout that has already passed fires at once.
+ */
+class xen_vcpu_timers
+{
+public:
+
+    explicit xen_vcpu_timers(const xen_tsc_clock &clock);
+
+    void set_singleshot(uint64_t timeout, uint64_t tsc);
+    void stop_singleshot();
+
+    void set_periodic(uint64_t period, uint64_t tsc);
+    void stop_periodic();
+
+    // Returns true if either timer fired, in which case the caller raises
+    // VIRQ_TIMER once for both.
+    bool expire(uint64_t tsc);
+
+    uint64_t deadline() const
+    { return m_wheel.deadline(); }
+
+private:
+
+    uint64_t cycles_until(uint64_t timeout, uint64_t tsc) const;
+
+    const xen_tsc_clock &m_clock;
+    xen_timer_wheel m_wheel;
+    xen_timer m_singleshot;
+    xen_timer m_periodic;
+    uint64_t m_period;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
@@ -0,0 +1,81 @@
+#ifndef XEN_VCPU_CONFIG_H
+#define XEN_VCPU_CONFIG_H
+
+#include <user_data.h>
+#include <exit_handler/xen_domain.h>
+#include <exit_handler/xen_policy.h>
+
+/*
+ * Passed as the user_data to vcpu_factory::make_vcpu to choose a vCPU's
+ * features. Bareflank's own start path passes none, so a vCPU made without
+ * one gets the build's configuration (see xen_build_vcpu_config).
+ *
+ * nr_vcpus is how many vCPUs the domain is expected to have. The vCPU that
+ * creates the domain sets up that many vCPUs' buffers and handler storage
+ * in one go, so the rest (and any brought up again later) start quickly.
+ * At 0, the default, the factory counts the host's logical CPUs.
+ *
+ * domain describes the guest's memory and p2m for start_info, and is only
+ * read by the vCPU that creates the domain. The hypervisor has no view of
+ * the guest's memory map, so it comes from whoever starts the vCPUs.
+ */
+struct xen_vcpu_config : public user_data
+{
+    xen_features features;
+    uint64_t nr_vcpus = 0;
+    xen_domain_info domain;
+};
+
+#ifndef XEN_NR_VCPUS
+#define XEN_NR_VCPUS 0
+#endif
+
+#ifndef XEN_NR_PAGES
+#define XEN_NR_PAGES 0
+#endif
+
+#ifndef XEN_MAX_PAGES
+#define XEN_MAX_PAGES XEN_NR_PAGES
+#endif
+
+#ifndef XEN_START_FLAGS
+#define XEN_START_FLAGS 0
+#endif
+
+/*
+ * The configuration set when the vCPU factory is built: every feature, less
+ * any turned off with XEN_NO_PVCLOCK, XEN_NO_EVENT_CHANNELS or
+ * XEN_NO_TRACING, the console discarded with XEN_CONSOLE_DISCARD, and
+ * XEN_NR_VCPUS expected vCPUs (by default, one per logical CPU). The guest
+ * has XEN_NR_PAGES pages, may balloon up to XEN_MAX_PAGES (by default the
+ * same), and gets XEN_START_FLAGS in start_info.
+ */
+inline xen_vcpu_config xen_build_vcpu_config()
+{
+    xen_vcpu_config config;
+
+#ifdef XEN_NO_PVCLOCK
+    config.features.pvclock = false;
+#endif
+#ifdef XEN_NO_EVENT_CHANNELS
+    config.features.event_channels = false;
+#endif
+#ifdef XEN_NO_TRACING
+    config.features.tracing = false;
+#endif
+#ifdef XEN_CONSOLE_DISCARD
+    config.features.console = xen_console_mode::discard;
+#endif
+
+    config.nr_vcpus = XEN_NR_VCPUS;
+    config.domain.nr_pages = XEN_NR_PAGES;
+    config.domain.max_pages = XEN_MAX_PAGES;
+    config.domain.flags = XEN_START_FLAGS;
+    return config;
+}
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
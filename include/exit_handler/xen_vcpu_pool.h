@@ -0,0 +1,60 @@
+#ifndef XEN_VCPU_POOL_H
+#define XEN_VCPU_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#define XEN_CACHE_LINE 64
+
+/*
+ * Fixed-size slots carved from one cache-aligned block, reserved up front
+ * for the expected number of vCPUs. Each exit handler is large (exit
+ * statistics, site table, log ring), and taking them all from one block
+ * saves a large VMM heap allocation, under the heap's global lock, as each
+ * CPU starts. A slot is returned when its vCPU is torn down, so a CPU that
+ * is brought back up reuses it. Requests beyond the reserved slots, or for
+ * a larger size, are left to the heap.
+ */
+class xen_vcpu_pool
+{
+public:
+
+    xen_vcpu_pool() = default;
+    xen_vcpu_pool(const xen_vcpu_pool &) = delete;
+    xen_vcpu_pool &operator=(const xen_vcpu_pool &) = delete;
+
+    // Only the first call reserves anything.
+    void reserve(size_t count, size_t size);
+
+    // nullptr if no slot fits.
+    void *alloc(size_t size);
+
+    // false if ptr is not one of the pool's slots.
+    bool free(void *ptr);
+
+    size_t available() const
+    { return m_available; }
+
+private:
+
+    struct slot
+    {
+        slot *next;
+    };
+
+    std::mutex m_mutex;
+    std::unique_ptr<uint8_t[]> m_block;
+    uint8_t *m_slots = nullptr;
+    size_t m_slot_size = 0;
+    size_t m_count = 0;
+    size_t m_available = 0;
+    slot *m_head = nullptr;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
@@ -0,0 +1,91 @@
+#ifndef XEN_VMCS_CACHE_H
+#define XEN_VMCS_CACHE_H
+
+#include <cstdint>
+#include <vmcs/vmcs_intel_x64.h>
+#include <vmcs/vmcs_intel_x64_32bit_read_only_data_fields.h>
+#include <vmcs/vmcs_intel_x64_64bit_guest_state_fields.h>
+#include <vmcs/vmcs_intel_x64_natural_width_guest_state_fields.h>
+#include <vmcs/vmcs_intel_x64_natural_width_read_only_data_fields.h>
+
+enum xen_vmcs_field
+{
+    xen_vmcs_guest_cr3,
+    xen_vmcs_guest_cr4,
+    xen_vmcs_guest_ia32_pat,
+    xen_vmcs_exit_instruction_length,
+    xen_vmcs_exit_qualification,
+    xen_vmcs_num_fields
+};
+
+/*
+ * The guest VMCS fields the Xen handlers read, each fetched with VMREAD at
+ * most once per exit. A VMREAD costs tens of cycles, and a full exit to the
+ * outer hypervisor when running nested. Writes go to the VMCS and update
+ * the cached value. The handler invalidates the cache when it resumes the
+ * guest.
+ *
+ * Guest RIP is not cached here: the state save already holds it, and it is
+ * written back from there on resume.
+ */
+class xen_vmcs_cache
+{
+public:
+
+    uint64_t guest_cr3()
+    { return get(xen_vmcs_guest_cr3, [] { return intel_x64::vmcs::guest_cr3::get(); }); }
+
+    void set_guest_cr3(uint64_t val)
+    { set(xen_vmcs_guest_cr3, [](auto v) { intel_x64::vmcs::guest_cr3::set(v); }, val); }
+
+    uint64_t guest_cr4()
+    { return get(xen_vmcs_guest_cr4, [] { return intel_x64::vmcs::guest_cr4::get(); }); }
+
+    uint64_t guest_ia32_pat()
+    { return get(xen_vmcs_guest_ia32_pat, [] { return intel_x64::vmcs::guest_ia32_pat::get(); }); }
+
+    void set_guest_ia32_pat(uint64_t val)
+    { set(xen_vmcs_guest_ia32_pat, [](auto v) { intel_x64::vmcs::guest_ia32_pat::set(v); }, val); }
+
+    uint64_t exit_instruction_length()
+    {
+        return get(xen_vmcs_exit_instruction_length,
+                   [] { return intel_x64::vmcs::vm_exit_instruction_length::get(); });
+    }
+
+    uint64_t exit_qualification()
+    { return get(xen_vmcs_exit_qualification, [] { return intel_x64::vmcs::exit_qualification::get(); }); }
+
+    void invalidate()
+    { m_valid = 0; }
+
+private:
+
+    template<class F>
+    uint64_t get(xen_vmcs_field field, F read)
+    {
+        if ((m_valid & (1U << field)) == 0) {
+            m_fields[field] = read();
+            m_valid |= 1U << field;
+        }
+
+        return m_fields[field];
+    }
+
+    template<class F>
+    void set(xen_vmcs_field field, F write, uint64_t val)
+    {
+        write(val);
+        m_fields[field] = val;
+        m_valid |= 1U << field;
+    }
+
+    uint32_t m_valid = 0;
+    uint64_t m_fields[xen_vmcs_num_fields] = {};
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
@@ -0,0 +1,83 @@
+#ifndef XEN_WAIT_H
+#define XEN_WAIT_H
+
+#include <atomic>
+#include <cstdint>
+
+// The longest a vCPU stays halted in SCHEDOP_block when the domain has no
+// way to kick it (see xen_domain::set_kick): nothing else interrupts a
+// halted vCPU when another one sends it an event, so the VMX preemption
+// timer brings it out this often to look.
+#define XEN_WAIT_SLICE_NS 100000ULL
+
+// The local APIC, through which a vCPU waking a blocked one sends an NMI
+// to the CPU it is halted on. Only x2APIC mode is used, where the ICR is a
+// single MSR. Defined in xen_sched_op.cpp
+bool x2apic_enabled(void);
+uint32_t x2apic_id(void);
+void x2apic_send_nmi(uint32_t apic_id);
+
+// The wait word while the vCPU is not blocked and while it is; a wakeup
+// replaces the latter with the TSC at which it happened.
+#define XEN_WAIT_RUNNING 0ULL
+#define XEN_WAIT_BLOCKED 1ULL
+
+/*
+ * A vCPU's wait state for SCHEDOP_block. A vCPU sending a blocked one an
+ * event leaves its TSC in the word with a single compare-and-swap, and the
+ * blocked vCPU reads it back when its block ends to measure the wakeup
+ * latency. The one whose swap succeeds kicks it, and marks the kick first,
+ * so the NMI exit it causes can be told from an NMI meant for the guest.
+ */
+class xen_wait
+{
+public:
+
+    xen_wait() :
+        m_word(XEN_WAIT_RUNNING),
+        m_kicked(false)
+    { }
+
+    void block()
+    { m_word.store(XEN_WAIT_BLOCKED, std::memory_order_seq_cst); }
+
+    // Returns the TSC of the wakeup, or 0 if the vCPU was not woken.
+    uint64_t unblock()
+    {
+        auto word = m_word.exchange(XEN_WAIT_RUNNING, std::memory_order_acq_rel);
+        return word > XEN_WAIT_BLOCKED ? word : 0;
+    }
+
+    // Called by whoever made an event pending for the vCPU. Cheap when it
+    // is not blocked: the word is only written to wake it. Returns whether
+    // this call woke it.
+    bool wake(uint64_t tsc)
+    {
+        uint64_t word = XEN_WAIT_BLOCKED;
+
+        if (m_word.load(std::memory_order_seq_cst) != XEN_WAIT_BLOCKED)
+            return false;
+
+        return m_word.compare_exchange_strong(word, tsc > XEN_WAIT_BLOCKED ? tsc : XEN_WAIT_BLOCKED + 1);
+    }
+
+    void set_kick()
+    { m_kicked.store(true, std::memory_order_release); }
+
+    // Whether an NMI exit was a kick. A kick and a guest NMI that arrive
+    // together may be told apart the wrong way round, but each is still
+    // counted once, so the guest gets as many NMIs as it was sent.
+    bool take_kick()
+    { return m_kicked.exchange(false, std::memory_order_acq_rel); }
+
+private:
+
+    std::atomic<uint64_t> m_word;
+    std::atomic<bool> m_kicked;
+};
+
+#endif
+
+// Local Variables:
+// Mode: c++
+// End:
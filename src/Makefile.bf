@@ -23,6 +23,7 @@
 # Subdirs
 ################################################################################
 
+PARENT_SUBDIRS += xen_page_ops
 PARENT_SUBDIRS += xen_exit_handler
 PARENT_SUBDIRS += xen_vcpu_factory
 
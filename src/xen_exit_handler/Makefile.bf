@@ -24,6 +24,8 @@
 ################################################################################
 
 SUBDIRS += src
+SUBDIRS += bench
+SUBDIRS += replay
 
 ################################################################################
 # Common
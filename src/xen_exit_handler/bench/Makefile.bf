@@ -0,0 +1,120 @@
+#
+# Bareflank Hypervisor
+#
+# Copyright (C) 2015 Assured Information Security, Inc.
+# Author: Rian Quinn        <quinnr@ainfosec.com>
+# Author: Brendan Kerrigan  <kerriganb@ainfosec.com>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+################################################################################
+# Target Information
+################################################################################
+
+TARGET_NAME:=xen_exit_bench
+TARGET_TYPE:=bin
+TARGET_COMPILER:=native
+
+################################################################################
+# Compiler Flags
+################################################################################
+
+NATIVE_CCFLAGS+=
+NATIVE_CCFLAGS+=
+NATIVE_CXXFLAGS+=
+NATIVE_ASMFLAGS+=
+NATIVE_LDFLAGS+=
+NATIVE_ARFLAGS+=
+NATIVE_DEFINES+=XEN_EXIT_STATS
+
+CROSS_CCFLAGS+=
+CROSS_CXXFLAGS+=
+CROSS_ASMFLAGS+=
+CROSS_LDFLAGS+=
+CROSS_ARFLAGS+=
+CROSS_DEFINES+=
+
+################################################################################
+# Output
+################################################################################
+
+CROSS_OBJDIR+=%BUILD_REL%/.build
+CROSS_OUTDIR+=%BUILD_REL%/../bin
+
+NATIVE_OBJDIR+=%BUILD_REL%/.build
+NATIVE_OUTDIR+=%BUILD_REL%/../bin
+
+################################################################################
+# Sources
+################################################################################
+
+SOURCES+=xen_exit_bench.cpp
+
+# The handler is compiled here against the mocks rather than linked, as the
+# mocks replace bfvmm headers that its code inlines.
+SOURCES+=../src/xen_exit_handler.cpp
+SOURCES+=../src/xen_domain.cpp
+SOURCES+=../src/xen_memory_op.cpp
+SOURCES+=../src/xen_mmuext_op.cpp
+SOURCES+=../src/xen_physmap.cpp
+SOURCES+=../src/xen_evtchn.cpp
+SOURCES+=../src/xen_event_channel_op.cpp
+SOURCES+=../src/xen_tbuf.cpp
+SOURCES+=../src/xen_log.cpp
+SOURCES+=../src/xen_capture.cpp
+SOURCES+=../src/xen_oprof.cpp
+SOURCES+=../src/xen_xenoprof_op.cpp
+SOURCES+=../src/xen_vcpu_pool.cpp
+SOURCES+=../src/xen_msr.cpp
+SOURCES+=../src/xen_cpuid.cpp
+SOURCES+=../src/xen_vcpu_op.cpp
+SOURCES+=../src/xen_time.cpp
+SOURCES+=../src/xen_runstate.cpp
+SOURCES+=../src/xen_timer.cpp
+SOURCES+=../src/xen_sched_op.cpp
+SOURCES+=../src/xen_hvm_op.cpp
+
+INCLUDE_PATHS+=%HYPER_ABS%/hypervisor_xen_extensions/src/xen_exit_handler/mock/
+INCLUDE_PATHS+=%HYPER_ABS%/hypervisor_xen_extensions/include/
+INCLUDE_PATHS+=%HYPER_ABS%/hypervisor_xen_extensions/include/exit_handler/
+
+LIBS+=xen_page_ops
+
+LIBRARY_PATHS+=%BUILD_REL%/../bin/native/
+
+################################################################################
+# Environment Specific
+################################################################################
+
+VMM_SOURCES+=
+VMM_INCLUDE_PATHS+=
+VMM_LIBS+=
+VMM_LIBRARY_PATHS+=
+
+WINDOWS_SOURCES+=
+WINDOWS_INCLUDE_PATHS+=
+WINDOWS_LIBS+=
+WINDOWS_LIBRARY_PATHS+=
+
+LINUX_SOURCES+=
+LINUX_INCLUDE_PATHS+=
+LINUX_LIBS+=
+LINUX_LIBRARY_PATHS+=
+
+################################################################################
+# Common
+################################################################################
+
+include %HYPER_ABS%/common/common_target.mk
@@ -0,0 +1,487 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <string>
+#include <exit_handler/xen_exit_handler.h>
+#include <exit_handler/xen_domain.h>
+#include <test_hypercalls.h>
+#include <xen.h>
+#include <xen_event_channel.h>
+#include <xen_hvm_op.h>
+#include <xen_hypercalls.h>
+#include <xen_memory.h>
+#include <xen_sched.h>
+#include <xen_vcpu.h>
+#include <xen_xenoprof.h>
+
+// Runs the real exit handler against the mocks in ../mock/ and reports the
+// cycles per operation of each exit path. Output is CSV:
+//
+//     bench,cycles_per_op,threshold,result,allocs,maps_per_op,vmreads_per_op
+//
+// Given a thresholds file (lines of "bench,max_cycles"), any bench over its
+// threshold is reported as "regressed" and the exit status is 1.
+//
+// Every heap allocation made by the process is counted. Exit paths must
+// not allocate once warm, as VMM heap allocation takes a global lock, so
+// a bench that allocates after its first op is reported as "allocates" and
+// also fails. Guest mappings come from the VMM's map pool rather than its
+// heap and are only reported, as are VMREADs.
+
+static constexpr const size_t batch = 256;
+static constexpr const size_t batches = 64;
+
+static uint64_t rdtsc_ordered()
+{
+    uint32_t low, high;
+
+    asm volatile ("lfence\n\t"
+                  "rdtsc"
+                  : "=a" (low), "=d" (high)
+                  :
+                  : "memory");
+    return low | static_cast<uint64_t>(high) << 32;
+}
+
+struct bench_env
+{
+    xen_domain domain;
+    xen_exit_handler handler{0, &domain};
+    vmcs_intel_x64 vmcs;
+    state_save_intel_x64 state_save = {};
+
+    bench_env()
+    {
+        handler.set_vmcs(&vmcs);
+        handler.set_state_save(&state_save);
+    }
+
+    void vmcall(uintptr_t nr, uintptr_t a1 = 0, uintptr_t a2 = 0, uintptr_t a3 = 0,
+                uintptr_t a4 = 0)
+    {
+        state_save.rax = nr;
+        state_save.rdi = a1;
+        state_save.rsi = a2;
+        state_save.rdx = a3;
+        state_save.r10 = a4;
+
+        handler.handle_exit(vmcs::exit_reason::basic_exit_reason::vmcall);
+    }
+};
+
+static std::map<std::string, uint64_t> g_thresholds;
+static int g_status = 0;
+static uint64_t g_allocs = 0;
+
+// Not inlined, so the compiler does not pair malloc and free across the
+// replacements and warn about a mismatched deallocation.
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    g_allocs++;
+
+    if (auto ptr = malloc(size != 0 ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{ return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    try {
+        return operator new(size);
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{ return operator new(size, tag); }
+
+__attribute__((noinline)) void operator delete(void *ptr) noexcept
+{ free(ptr); }
+
+void operator delete[](void *ptr) noexcept
+{ operator delete(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept
+{ operator delete(ptr); }
+
+void operator delete[](void *ptr, size_t) noexcept
+{ operator delete(ptr); }
+
+static void load_thresholds(const char *path)
+{
+    auto file = fopen(path, "r");
+    char line[256];
+    char name[128];
+    unsigned long long cycles;
+
+    if (file == nullptr) {
+        fprintf(stderr, "unable to open %s\n", path);
+        exit(2);
+    }
+
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        if (line[0] != '#' && sscanf(line, " %127[^,],%llu", name, &cycles) == 2)
+            g_thresholds[name] = cycles;
+    }
+
+    fclose(file);
+}
+
+template<class F>
+static void bench(const char *name, F op, size_t ops = batch, size_t rounds = batches)
+{
+    auto best = ~0ULL;
+
+    // The first op may set up per-vCPU state; everything after it is
+    // steady state. Ops that take milliseconds run fewer, smaller batches.
+    op();
+
+    auto allocs = g_allocs;
+    auto maps = mock::maps();
+    auto vmreads = mock::vmreads();
+
+    for (auto b = 0UL; b < rounds; b++) {
+        auto start = rdtsc_ordered();
+        for (auto i = 0UL; i < ops; i++)
+            op();
+        auto elapsed = rdtsc_ordered() - start;
+
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    allocs = g_allocs - allocs;
+    maps = mock::maps() - maps;
+    vmreads = mock::vmreads() - vmreads;
+
+    auto cycles = best / ops;
+    auto threshold = g_thresholds.find(name);
+    auto ok = threshold == g_thresholds.end() || cycles <= threshold->second;
+    auto result = allocs != 0 ? "allocates" : !ok ? "regressed" : "ok";
+
+    if (threshold == g_thresholds.end())
+        printf("%s,%llu,,%s", name, cycles, allocs != 0 ? result : "");
+    else
+        printf("%s,%llu,%llu,%s", name, cycles,
+               static_cast<unsigned long long>(threshold->second), result);
+
+    printf(",%llu,%llu,%llu\n", static_cast<unsigned long long>(allocs),
+           static_cast<unsigned long long>(maps / (ops * rounds)),
+           static_cast<unsigned long long>(vmreads / (ops * rounds)));
+
+    if (allocs != 0 || !ok)
+        g_status = 1;
+}
+
+// Backs every frame from BENCH_1G_GPFN up with one scratch page, so a 1G extent
+// can be ballooned without a gigabyte of host memory behind it.
+#define BENCH_1G_GPFN (1UL << 28)
+
+class bench_1g_memory : public mock::guest_memory
+{
+public:
+
+    bench_1g_memory(uint8_t *scratch) :
+        m_scratch(scratch)
+    { }
+
+    void *phys(uintptr_t addr) override
+    {
+        if ((addr >> 12) >= BENCH_1G_GPFN)
+            return m_scratch + (addr & (PAGE_SIZE - 1));
+
+        return guest_memory::phys(addr);
+    }
+
+private:
+
+    uint8_t *m_scratch;
+};
+
+static uint8_t *alloc_pages(size_t pages)
+{
+    auto ptr = aligned_alloc(PAGE_SIZE, pages * PAGE_SIZE);
+
+    if (ptr == nullptr)
+        abort();
+
+    memset(ptr, 0, pages * PAGE_SIZE);
+    return static_cast<uint8_t *>(ptr);
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc > 1)
+        load_thresholds(argv[1]);
+
+    auto env = new bench_env;
+    auto pages = alloc_pages(9);
+    auto text = reinterpret_cast<char *>(pages + PAGE_SIZE);
+    auto pfn = [&](size_t page) { return reinterpret_cast<uintptr_t>(pages + page * PAGE_SIZE) >> 12; };
+
+    memset(text, 'x', PAGE_SIZE);
+
+    printf("bench,cycles_per_op,threshold,result,allocs,maps_per_op,vmreads_per_op\n");
+
+    bench("cpuid_xen_leaf", [&] {
+        env->state_save.rax = XEN_CPUID_FIRST_LEAF;
+        env->handler.handle_exit(vmcs::exit_reason::basic_exit_reason::cpuid);
+    });
+
+    bench("cpuid_cached", [&] {
+        env->state_save.rax = 0;
+        env->handler.handle_exit(vmcs::exit_reason::basic_exit_reason::cpuid);
+    });
+
+    bench("cpuid_cached_leaf_1", [&] {
+        env->state_save.rax = 1;
+        env->handler.handle_exit(vmcs::exit_reason::basic_exit_reason::cpuid);
+    });
+
+    bench("init_hypercall_page", [&] {
+        init_hypercall_page(pages);
+    });
+
+    bench("wrmsr_hypercall_page", [&] {
+        env->state_save.rcx = 0x40000000;
+        env->state_save.rax = reinterpret_cast<uintptr_t>(pages) & 0xFFFFFFFF;
+        env->state_save.rdx = reinterpret_cast<uintptr_t>(pages) >> 32;
+        env->handler.handle_exit(vmcs::exit_reason::basic_exit_reason::wrmsr);
+    });
+
+    // Moving the page between two frames rewrites it on every write.
+    auto moves = 0UL;
+    bench("wrmsr_hypercall_page_move", [&] {
+        auto page = reinterpret_cast<uintptr_t>(pages + (moves++ & 1) * 7 * PAGE_SIZE);
+        env->state_save.rcx = 0x40000000;
+        env->state_save.rax = page & 0xFFFFFFFF;
+        env->state_save.rdx = page >> 32;
+        env->handler.handle_exit(vmcs::exit_reason::basic_exit_reason::wrmsr);
+    });
+
+    for (auto size : { 16UL, 256UL, 4096UL }) {
+        auto name = "console_io_write_" + std::to_string(size);
+
+        bench(name.c_str(), [&] {
+            env->vmcall(xen_hypercall::console_io, xen_hypercall::console_io_cmd::write,
+                        size, reinterpret_cast<uintptr_t>(text));
+        });
+    }
+
+    bench("set_bareflank_time", [&] {
+        env->vmcall(SET_BAREFLANK_TIME, rdtsc(), 1500000000, 0);
+    });
+
+    auto xatp = reinterpret_cast<xen_add_to_physmap *>(pages + 2 * PAGE_SIZE);
+    xatp->domid = DOMID_SELF;
+    xatp->space = XENMAPSPACE_shared_info;
+    xatp->idx = 0;
+    xatp->gpfn = pfn(3);
+
+    bench("memory_op_add_to_physmap", [&] {
+        env->vmcall(xen_hypercall::memory_op, XENMEM_add_to_physmap,
+                    reinterpret_cast<uintptr_t>(xatp));
+    });
+
+    auto reservation = reinterpret_cast<xen_memory_reservation *>(pages + 2 * PAGE_SIZE + 512);
+    auto extents = reinterpret_cast<xen_pfn_t *>(pages + 2 * PAGE_SIZE + 1024);
+    extents[0] = pfn(4);
+    reservation->extent_start = extents;
+    reservation->nr_extents = 1;
+    reservation->extent_order = 0;
+    reservation->domid = DOMID_SELF;
+
+    bench("memory_op_balloon_round_trip", [&] {
+        env->vmcall(xen_hypercall::memory_op, XENMEM_decrease_reservation,
+                    reinterpret_cast<uintptr_t>(reservation));
+        env->vmcall(xen_hypercall::memory_op, XENMEM_populate_physmap,
+                    reinterpret_cast<uintptr_t>(reservation));
+    });
+
+    // One exit's worth of a 1G populate: the extent is ballooned out again
+    // first, so each op starts from the same 2^18 dirty frames and the
+    // exit zeroes its budget of them before asking to be continued.
+    auto reservation_1g = reinterpret_cast<xen_memory_reservation *>(pages + 2 * PAGE_SIZE + 1536);
+    auto extents_1g = reinterpret_cast<xen_pfn_t *>(pages + 2 * PAGE_SIZE + 1536 + 64);
+    extents_1g[0] = BENCH_1G_GPFN;
+    reservation_1g->extent_start = extents_1g;
+    reservation_1g->nr_extents = 1;
+    reservation_1g->extent_order = 18;
+    reservation_1g->domid = DOMID_SELF;
+
+    auto guest = mock::guest();
+    bench_1g_memory memory_1g(pages + 7 * PAGE_SIZE);
+    mock::guest() = &memory_1g;
+
+    bench("memory_op_populate_1g_exit", [&] {
+        env->vmcall(xen_hypercall::memory_op, XENMEM_decrease_reservation,
+                    reinterpret_cast<uintptr_t>(reservation_1g));
+        env->vmcall(xen_hypercall::memory_op, XENMEM_populate_physmap,
+                    reinterpret_cast<uintptr_t>(reservation_1g));
+    }, 4, 4);
+
+    // Left half zeroed, the extent would be found by the scrubber later.
+    while (!env->domain.physmap().is_populated(BENCH_1G_GPFN)) {
+        env->vmcall(xen_hypercall::memory_op, XENMEM_populate_physmap,
+                    reinterpret_cast<uintptr_t>(reservation_1g));
+    }
+
+    mock::guest() = guest;
+
+    auto ops = reinterpret_cast<mmuext_op *>(pages + 2 * PAGE_SIZE + 2048);
+    ops[0].cmd = MMUEXT_CLEAR_PAGE;
+    ops[0].arg1.mfn = pfn(5);
+    ops[1].cmd = MMUEXT_COPY_PAGE;
+    ops[1].arg1.mfn = pfn(6);
+    ops[1].arg2.src_mfn = pfn(5);
+
+    bench("mmuext_op_clear_page", [&] {
+        env->vmcall(xen_hypercall::mmuext_op, reinterpret_cast<uintptr_t>(&ops[0]), 1, 0, DOMID_SELF);
+    });
+
+    bench("mmuext_op_copy_page", [&] {
+        env->vmcall(xen_hypercall::mmuext_op, reinterpret_cast<uintptr_t>(&ops[1]), 1, 0, DOMID_SELF);
+    });
+
+    auto bind_ipi = reinterpret_cast<evtchn_bind_ipi *>(pages + 2 * PAGE_SIZE + 3072);
+    auto send = reinterpret_cast<evtchn_send *>(pages + 2 * PAGE_SIZE + 3072 + 64);
+    bind_ipi->vcpu = 0;
+    env->vmcall(xen_hypercall::event_channel_op, xen_hypercall::event_channel_op_cmd::bind_ipi,
+                reinterpret_cast<uintptr_t>(bind_ipi));
+    send->port = bind_ipi->port;
+
+    bench("event_channel_op_send", [&] {
+        env->domain.shared_info()->evtchn_pending[send->port / 64] = 0;
+        env->vmcall(xen_hypercall::event_channel_op, xen_hypercall::event_channel_op_cmd::send,
+                    reinterpret_cast<uintptr_t>(send));
+    });
+
+    auto unmask = reinterpret_cast<evtchn_unmask *>(pages + 2 * PAGE_SIZE + 3072 + 128);
+    unmask->port = send->port;
+
+    bench("event_channel_op_unmask", [&] {
+        env->vmcall(xen_hypercall::event_channel_op, xen_hypercall::event_channel_op_cmd::unmask,
+                    reinterpret_cast<uintptr_t>(unmask));
+    });
+
+    bench("console_io_read", [&] {
+        env->vmcall(xen_hypercall::console_io, xen_hypercall::console_io_cmd::read, 0, 0);
+    });
+
+    auto get_buffer = reinterpret_cast<xenoprof_get_buffer *>(pages + 2 * PAGE_SIZE + 3072 + 192);
+
+    bench("xenoprof_op_get_buffer", [&] {
+        env->vmcall(xen_hypercall::xenoprof_op, XENOPROF_get_buffer,
+                    reinterpret_cast<uintptr_t>(get_buffer));
+    });
+
+    bench("hlt_idle", [&] {
+        env->handler.handle_exit(vmcs::exit_reason::basic_exit_reason::hlt);
+    });
+
+    // A tickless guest moves its single-shot timer on most idle entries.
+    auto timeouts = 0UL;
+    bench("set_timer_op", [&] {
+        auto now = env->domain.clock().ns(rdtsc());
+        env->vmcall(xen_hypercall::set_timer_op, now + NSEC_PER_MSEC + (timeouts++ & 0xFF) * 1000);
+    });
+
+    auto singleshot = reinterpret_cast<vcpu_set_singleshot_timer *>(pages + 2 * PAGE_SIZE + 3072 + 256);
+    singleshot->flags = VCPU_SSHOTTMR_future;
+
+    bench("vcpu_op_set_singleshot_timer", [&] {
+        singleshot->timeout_abs_ns = env->domain.clock().ns(rdtsc()) + NSEC_PER_MSEC;
+        env->vmcall(xen_hypercall::vcpu_op, VCPUOP_set_singleshot_timer, 0,
+                    reinterpret_cast<uintptr_t>(singleshot));
+    });
+
+    // Sets a timer that is already due, which the next exit fires.
+    bench("timer_expiry", [&] {
+        env->vmcall(xen_hypercall::set_timer_op, 1);
+        env->handler.handle_exit(vmcs::exit_reason::basic_exit_reason::preemption_timer_expired);
+    });
+
+    bench("sched_op_yield", [&] {
+        env->vmcall(xen_hypercall::sched_op, SCHEDOP_yield);
+    });
+
+    // Blocks with an event already pending, which returns at once.
+    auto info = env->domain.vcpu_info(0);
+
+    bench("sched_op_block_pending", [&] {
+        info->evtchn_upcall_pending = 1;
+        env->vmcall(xen_hypercall::sched_op, SCHEDOP_block);
+    });
+
+    // Halts the vCPU, then ends the block on the preemption timer exit that
+    // finds an event sent to it.
+    bench("sched_op_block", [&] {
+        info->evtchn_upcall_pending = 0;
+        env->vmcall(xen_hypercall::sched_op, SCHEDOP_block);
+        info->evtchn_upcall_pending = 1;
+        env->handler.handle_exit(vmcs::exit_reason::basic_exit_reason::preemption_timer_expired);
+    });
+
+    // The same with a domain that kicks: the vCPU sending the event wakes
+    // the blocked one, which takes the kick's NMI exit. The time from the
+    // wake to the end of the block is what the statistics page reports as
+    // wakeup latency, less the NMI's delivery.
+    env->domain.set_kick([](uint32_t) { });
+    mock::vmcs(mock::vm_exit_interruption_information) = VM_ENTRY_INTERRUPTION_VALID | VM_INTERRUPTION_TYPE_NMI |
+                                                         VM_INTERRUPTION_VECTOR_NMI;
+
+    bench("sched_op_block_kick", [&] {
+        info->evtchn_upcall_pending = 0;
+        env->vmcall(xen_hypercall::sched_op, SCHEDOP_block);
+        info->evtchn_upcall_pending = 1;
+        env->domain.wake(0);
+        env->handler.handle_exit(vmcs::exit_reason::basic_exit_reason::exception_or_non_maskable_interrupt);
+    });
+
+    env->domain.set_kick(nullptr);
+
+    auto param = reinterpret_cast<xen_hvm_param *>(pages + 2 * PAGE_SIZE + 3072 + 320);
+    param->domid = DOMID_SELF;
+    param->index = HVM_PARAM_CALLBACK_IRQ;
+    param->value = static_cast<uint64_t>(HVM_PARAM_CALLBACK_TYPE_VECTOR) << HVM_PARAM_CALLBACK_TYPE_SHIFT | 0xF3;
+
+    bench("hvm_op_set_param", [&] {
+        env->vmcall(xen_hypercall::hvm_op, HVMOP_set_param, reinterpret_cast<uintptr_t>(param));
+    });
+
+    // The interrupt window exit taken for an upcall that arrived while the
+    // guest had interrupts off, and the injection on its entry.
+    mock::vmcs(mock::guest_rflags) = RFLAGS_IF;
+
+    bench("upcall_interrupt_window", [&] {
+        info->evtchn_upcall_pending = 1;
+        mock::vmcs(mock::vm_entry_interruption_information_field) = 0;
+        env->handler.handle_exit(vmcs::exit_reason::basic_exit_reason::interrupt_window);
+    });
+
+    info->evtchn_upcall_pending = 0;
+    param->value = 0;
+    env->vmcall(xen_hypercall::hvm_op, HVMOP_set_param, reinterpret_cast<uintptr_t>(param));
+
+    // Every exit benched so far has left its site in the table.
+    auto sites = reinterpret_cast<uintptr_t>(pages + 8 * PAGE_SIZE);
+
+    bench("dump_exit_sites", [&] {
+        env->vmcall(DUMP_EXIT_SITES, 0, sites, PAGE_SIZE);
+    });
+
+    bench("unknown_vmcall", [&] {
+        env->vmcall(0x7fffffff);
+    });
+
+    return g_status;
+}
@@ -0,0 +1,70 @@
+#ifndef MOCK_EXIT_HANDLER_INTEL_X64_H
+#define MOCK_EXIT_HANDLER_INTEL_X64_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <debug.h>
+#include <vmcs/vmcs_intel_x64.h>
+#include <memory_manager/map_ptr_x64.h>
+
+#define VMCALL_MAGIC_NUMBER 0xB045EACDACD52E22
+#define BF_VMCALL_SUCCESS 0
+#define BF_VMCALL_FAILURE -1
+
+struct vmcall_registers_t
+{
+    uintptr_t r00, r01, r02, r03, r04, r05, r06, r07;
+    uintptr_t r08, r09, r10, r11, r12, r13, r14, r15;
+};
+
+struct state_save_intel_x64
+{
+    uintptr_t rax, rbx, rcx, rdx, rbp, rsi, rdi;
+    uintptr_t r08, r09, r10, r11, r12, r13, r14, r15;
+    uintptr_t rip, rsp;
+};
+
+template<class F>
+int64_t guard_exceptions(int64_t error, F func)
+{
+    try {
+        func();
+    }
+    catch (...) {
+        return error;
+    }
+
+    return BF_VMCALL_SUCCESS;
+}
+
+class exit_handler_intel_x64
+{
+public:
+
+    using ret_type = int64_t;
+
+    virtual ~exit_handler_intel_x64() = default;
+
+    virtual void handle_exit(intel_x64::vmcs::value_type reason)
+    { (void) reason; }
+
+    void set_vmcs(vmcs_intel_x64 *vmcs)
+    { m_vmcs = vmcs; }
+
+    void set_state_save(state_save_intel_x64 *state_save)
+    { m_state_save = state_save; }
+
+protected:
+
+    void advance_rip()
+    { m_state_save->rip += 3; }
+
+    vmcs_intel_x64 *m_vmcs = nullptr;
+    state_save_intel_x64 *m_state_save = nullptr;
+};
+
+#endif
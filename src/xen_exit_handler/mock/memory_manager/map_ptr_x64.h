@@ -0,0 +1,101 @@
+#ifndef MOCK_MAP_PTR_X64_H
+#define MOCK_MAP_PTR_X64_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Guest memory back-end. By default guest virtual, guest physical and host
+ * addresses are all the same, so the handler's mappings resolve to the
+ * benchmark's own buffers without a page walk. A tool that needs its own
+ * model of guest memory (the replay tool) installs one with mock::guest().
+ */
+
+namespace mock
+{
+    class guest_memory
+    {
+    public:
+
+        virtual ~guest_memory() = default;
+
+        virtual void *virt(uintptr_t gva, uintptr_t cr3, size_t size)
+        {
+            (void) cr3;
+            (void) size;
+
+            return reinterpret_cast<void *>(gva);
+        }
+
+        virtual void *phys(uintptr_t addr)
+        { return reinterpret_cast<void *>(addr); }
+    };
+
+    // Mappings made so far, as each one costs a map-pool allocation and a
+    // page walk in the VMM.
+    inline uint64_t &maps()
+    {
+        static uint64_t count;
+        return count;
+    }
+
+    inline guest_memory *&guest()
+    {
+        static guest_memory identity;
+        static guest_memory *current = &identity;
+
+        return current;
+    }
+}
+
+namespace bfn
+{
+
+template<class T>
+class unique_map_ptr_x64
+{
+public:
+
+    unique_map_ptr_x64(T *ptr = nullptr) :
+        m_ptr(ptr)
+    { }
+
+    T *get() const
+    { return m_ptr; }
+
+    T *operator->() const
+    { return m_ptr; }
+
+    explicit operator bool() const
+    { return m_ptr != nullptr; }
+
+private:
+
+    T *m_ptr;
+};
+
+template<class T>
+unique_map_ptr_x64<T> make_unique_map_x64(uintptr_t phys)
+{
+    mock::maps()++;
+    return unique_map_ptr_x64<T>(static_cast<T *>(mock::guest()->phys(phys)));
+}
+
+template<class T>
+unique_map_ptr_x64<T> make_unique_map_x64(uintptr_t virt, uintptr_t cr3, size_t size, uintptr_t pat)
+{
+    (void) pat;
+
+    mock::maps()++;
+    return unique_map_ptr_x64<T>(static_cast<T *>(mock::guest()->virt(virt, cr3, size)));
+}
+
+inline uintptr_t virt_to_phys_with_cr3(uintptr_t virt, uintptr_t cr3)
+{
+    (void) cr3;
+    return virt;
+}
+
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef MOCK_MEMORY_MANAGER_X64_H
+#define MOCK_MEMORY_MANAGER_X64_H
+
+#include <cstdint>
+
+// Identity-mapped: a benchmark "physical" address is its virtual address.
+class memory_manager_x64
+{
+public:
+
+    static memory_manager_x64 *instance()
+    {
+        static memory_manager_x64 self;
+        return &self;
+    }
+
+    uintptr_t virtptr_to_physint(void *virt) const
+    { return reinterpret_cast<uintptr_t>(virt); }
+};
+
+#define g_mm memory_manager_x64::instance()
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef MOCK_VCPUID_H
+#define MOCK_VCPUID_H
+
+#include <cstdint>
+
+namespace vcpuid
+{
+    using type = uint64_t;
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef MOCK_VMCS_INTEL_X64_H
+#define MOCK_VMCS_INTEL_X64_H
+
+#include <cstdint>
+
+/*
+ * Native stand-in for the VMCS. Fields are plain variables, so the exit
+ * handler's vmread/vmwrite sites cost a load or a store, and resume()
+ * returns to the benchmark instead of entering the guest.
+ */
+
+namespace mock
+{
+    enum vmcs_field
+    {
+        guest_cr3,
+        guest_cr4,
+        guest_ia32_pat,
+        guest_rip,
+        guest_cs_selector,
+        guest_activity_state,
+        guest_rflags,
+        guest_interruptibility_state,
+        vm_entry_interruption_information_field,
+        vm_exit_instruction_length,
+        vm_exit_interruption_information,
+        exit_qualification,
+        vmx_preemption_timer_value,
+        hlt_exiting,
+        interrupt_window_exiting,
+        nmi_window_exiting,
+        use_msr_bitmap,
+        address_of_msr_bitmap,
+        activate_vmx_preemption_timer,
+        nmi_exiting,
+        virtual_nmis,
+        save_vmx_preemption_timer_value,
+        num_vmcs_fields
+    };
+
+    inline uint64_t &vmcs(vmcs_field field)
+    {
+        static uint64_t fields[num_vmcs_fields];
+        return fields[field];
+    }
+
+    // VMREADs issued so far, as each one is a full exit when nested.
+    inline uint64_t &vmreads()
+    {
+        static uint64_t count;
+        return count;
+    }
+
+    inline uint64_t vmread(vmcs_field field)
+    {
+        vmreads()++;
+        return vmcs(field);
+    }
+}
+
+namespace intel_x64
+{
+namespace vmcs
+{
+    using value_type = uint64_t;
+
+    namespace guest_cr3
+    {
+        inline value_type get() { return mock::vmread(mock::guest_cr3); }
+        inline void set(value_type val) { mock::vmcs(mock::guest_cr3) = val; }
+    }
+
+    namespace guest_cr4
+    {
+        inline value_type get() { return mock::vmread(mock::guest_cr4); }
+        inline void set(value_type val) { mock::vmcs(mock::guest_cr4) = val; }
+    }
+
+    namespace guest_ia32_pat
+    {
+        inline value_type get() { return mock::vmread(mock::guest_ia32_pat); }
+        inline void set(value_type val) { mock::vmcs(mock::guest_ia32_pat) = val; }
+    }
+
+    namespace guest_rip
+    {
+        inline value_type get() { return mock::vmread(mock::guest_rip); }
+        inline void set(value_type val) { mock::vmcs(mock::guest_rip) = val; }
+    }
+
+    namespace vm_exit_instruction_length
+    {
+        inline value_type get() { return mock::vmread(mock::vm_exit_instruction_length); }
+    }
+
+    namespace vm_exit_interruption_information
+    {
+        inline value_type get() { return mock::vmread(mock::vm_exit_interruption_information); }
+    }
+
+    namespace exit_qualification
+    {
+        inline value_type get() { return mock::vmread(mock::exit_qualification); }
+    }
+
+    namespace guest_cs_selector
+    {
+        inline value_type get() { return mock::vmread(mock::guest_cs_selector); }
+        inline void set(value_type val) { mock::vmcs(mock::guest_cs_selector) = val; }
+    }
+
+    namespace guest_activity_state
+    {
+        constexpr const value_type active = 0;
+        constexpr const value_type hlt = 1;
+
+        inline value_type get() { return mock::vmread(mock::guest_activity_state); }
+        inline void set(value_type val) { mock::vmcs(mock::guest_activity_state) = val; }
+    }
+
+    namespace guest_rflags
+    {
+        inline value_type get() { return mock::vmread(mock::guest_rflags); }
+        inline void set(value_type val) { mock::vmcs(mock::guest_rflags) = val; }
+    }
+
+    namespace guest_interruptibility_state
+    {
+        inline value_type get() { return mock::vmread(mock::guest_interruptibility_state); }
+        inline void set(value_type val) { mock::vmcs(mock::guest_interruptibility_state) = val; }
+    }
+
+    namespace vm_entry_interruption_information_field
+    {
+        inline value_type get() { return mock::vmread(mock::vm_entry_interruption_information_field); }
+        inline void set(value_type val) { mock::vmcs(mock::vm_entry_interruption_information_field) = val; }
+    }
+
+    namespace vmx_preemption_timer_value
+    {
+        inline value_type get() { return mock::vmread(mock::vmx_preemption_timer_value); }
+        inline void set(value_type val) { mock::vmcs(mock::vmx_preemption_timer_value) = val; }
+    }
+
+    namespace pin_based_vm_execution_controls
+    {
+        namespace activate_vmx_preemption_timer
+        {
+            inline void enable() { mock::vmcs(mock::activate_vmx_preemption_timer) = 1; }
+            inline void disable() { mock::vmcs(mock::activate_vmx_preemption_timer) = 0; }
+        }
+
+        namespace nmi_exiting
+        {
+            inline void enable() { mock::vmcs(mock::nmi_exiting) = 1; }
+            inline void disable() { mock::vmcs(mock::nmi_exiting) = 0; }
+        }
+
+        namespace virtual_nmis
+        {
+            inline void enable() { mock::vmcs(mock::virtual_nmis) = 1; }
+            inline void disable() { mock::vmcs(mock::virtual_nmis) = 0; }
+        }
+    }
+
+    namespace vm_exit_controls
+    {
+        namespace save_vmx_preemption_timer_value
+        {
+            inline void enable() { mock::vmcs(mock::save_vmx_preemption_timer_value) = 1; }
+            inline void disable() { mock::vmcs(mock::save_vmx_preemption_timer_value) = 0; }
+        }
+    }
+
+    namespace address_of_msr_bitmap
+    {
+        inline value_type get() { return mock::vmread(mock::address_of_msr_bitmap); }
+        inline void set(value_type val) { mock::vmcs(mock::address_of_msr_bitmap) = val; }
+    }
+
+    namespace primary_processor_based_vm_execution_controls
+    {
+        namespace hlt_exiting
+        {
+            inline void enable() { mock::vmcs(mock::hlt_exiting) = 1; }
+            inline void disable() { mock::vmcs(mock::hlt_exiting) = 0; }
+        }
+
+        namespace interrupt_window_exiting
+        {
+            inline void enable() { mock::vmcs(mock::interrupt_window_exiting) = 1; }
+            inline void disable() { mock::vmcs(mock::interrupt_window_exiting) = 0; }
+        }
+
+        namespace nmi_window_exiting
+        {
+            inline void enable() { mock::vmcs(mock::nmi_window_exiting) = 1; }
+            inline void disable() { mock::vmcs(mock::nmi_window_exiting) = 0; }
+        }
+
+        namespace use_msr_bitmap
+        {
+            inline void enable() { mock::vmcs(mock::use_msr_bitmap) = 1; }
+            inline void disable() { mock::vmcs(mock::use_msr_bitmap) = 0; }
+        }
+    }
+
+    namespace exit_reason
+    {
+        namespace basic_exit_reason
+        {
+            constexpr const value_type exception_or_non_maskable_interrupt = 0;
+            constexpr const value_type interrupt_window = 7;
+            constexpr const value_type nmi_window = 8;
+            constexpr const value_type cpuid = 10;
+            constexpr const value_type hlt = 12;
+            constexpr const value_type vmcall = 18;
+            constexpr const value_type rdmsr = 31;
+            constexpr const value_type wrmsr = 32;
+            constexpr const value_type preemption_timer_expired = 52;
+            constexpr const value_type xsetbv = 55;
+        }
+    }
+}
+}
+
+class vmcs_intel_x64
+{
+public:
+
+    virtual ~vmcs_intel_x64() = default;
+
+    virtual void resume()
+    { m_resumes++; }
+
+    uint64_t m_resumes = 0;
+};
+
+#endif
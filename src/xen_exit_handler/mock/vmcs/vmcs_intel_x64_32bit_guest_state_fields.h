@@ -0,0 +1 @@
+#include <vmcs/vmcs_intel_x64.h>
@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <exit_handler/xen_capture.h>
+#include <exit_handler/xen_domain.h>
+#include <exit_handler/xen_exit_handler.h>
+
+// Drives the real exit handler, built against the mocks in ../mock/, from
+// capture logs recorded with XEN_EXIT_CAPTURE (see xen_capture.h). Each
+// exit's guest memory is served from the bytes captured with it; physical
+// frames the handler maps directly were never captured and are modelled as
+// zero-filled pages. Output is CSV:
+//
+//     exit,count,cycles_per_exit
+//
+// where a vmcall exit is split by hypercall number ("vmcall:<rax>").
+
+static uint64_t rdtsc_ordered()
+{
+    uint32_t low, high;
+
+    asm volatile ("lfence\n\t"
+                  "rdtsc"
+                  : "=a" (low), "=d" (high)
+                  :
+                  : "memory");
+    return low | static_cast<uint64_t>(high) << 32;
+}
+
+struct replay_region
+{
+    uint64_t gva;
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> work;
+    bool used;
+};
+
+struct replay_exit
+{
+    uint64_t vcpuid;
+    const xen_capture_exit *rec;
+    std::vector<replay_region> regions;
+};
+
+class replay_memory : public mock::guest_memory
+{
+public:
+
+    // Each mapping the handler makes is matched, in order, to a region
+    // captured with the current exit. The handler gets a scratch copy, so
+    // its writes do not leak into the next iteration.
+    void begin(replay_exit &exit)
+    {
+        m_exit = &exit;
+
+        for (auto &&region : exit.regions)
+            region.used = false;
+    }
+
+    void *virt(uintptr_t gva, uintptr_t cr3, size_t size) override
+    {
+        (void) cr3;
+
+        for (auto &&region : m_exit->regions) {
+            if (region.used || region.gva != gva || region.data.size() < size)
+                continue;
+
+            region.used = true;
+            region.work = region.data;
+
+            return region.work.data();
+        }
+
+        m_missed++;
+        m_scratch.assign(std::max<size_t>(size, 1), 0);
+
+        return m_scratch.data();
+    }
+
+    void *phys(uintptr_t addr) override
+    {
+        auto &&frame = m_frames[addr >> 12];
+
+        if (!frame) {
+            frame = std::make_unique<uint8_t[]>(PAGE_SIZE);
+            memset(frame.get(), 0, PAGE_SIZE);
+        }
+
+        return frame.get() + (addr & (PAGE_SIZE - 1));
+    }
+
+    uint64_t missed() const
+    { return m_missed; }
+
+private:
+
+    replay_exit *m_exit = nullptr;
+    std::vector<uint8_t> m_scratch;
+    std::map<uintptr_t, std::unique_ptr<uint8_t[]>> m_frames;
+    uint64_t m_missed = 0;
+};
+
+struct replay_vcpu
+{
+    xen_exit_handler handler;
+    vmcs_intel_x64 vmcs;
+    state_save_intel_x64 state_save = {};
+
+    replay_vcpu(uint64_t vcpuid, xen_domain *domain) :
+        handler(vcpuid, domain)
+    {
+        handler.set_vmcs(&vmcs);
+        handler.set_state_save(&state_save);
+    }
+
+    void load(const xen_capture_exit *rec)
+    {
+        auto &&r = rec->regs;
+
+        state_save.rax = r[xen_capture_rax];
+        state_save.rbx = r[xen_capture_rbx];
+        state_save.rcx = r[xen_capture_rcx];
+        state_save.rdx = r[xen_capture_rdx];
+        state_save.rbp = r[xen_capture_rbp];
+        state_save.rsi = r[xen_capture_rsi];
+        state_save.rdi = r[xen_capture_rdi];
+        state_save.r08 = r[xen_capture_r08];
+        state_save.r09 = r[xen_capture_r09];
+        state_save.r10 = r[xen_capture_r10];
+        state_save.r11 = r[xen_capture_r11];
+        state_save.r12 = r[xen_capture_r12];
+        state_save.r13 = r[xen_capture_r13];
+        state_save.r14 = r[xen_capture_r14];
+        state_save.r15 = r[xen_capture_r15];
+        state_save.rip = r[xen_capture_rip];
+        state_save.rsp = r[xen_capture_rsp];
+
+        vmcs::guest_cr3::set(rec->guest_cr3);
+        vmcs::guest_ia32_pat::set(rec->guest_ia32_pat);
+        vmcs::guest_rip::set(r[xen_capture_rip]);
+    }
+};
+
+struct replay_result
+{
+    uint64_t count = 0;
+    uint64_t cycles = 0;
+};
+
+static std::vector<uint8_t> read_file(const char *path)
+{
+    std::vector<uint8_t> buf;
+    auto file = fopen(path, "rb");
+    uint8_t chunk[4096];
+    size_t len;
+
+    if (file == nullptr) {
+        fprintf(stderr, "unable to open %s\n", path);
+        exit(2);
+    }
+
+    while ((len = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        buf.insert(buf.end(), chunk, chunk + len);
+
+    fclose(file);
+    return buf;
+}
+
+// Logs are kept in memory for the life of the replay, as the parsed exits
+// point into them.
+static void parse_log(const std::vector<uint8_t> &log, const char *path,
+                      std::vector<replay_exit> &exits)
+{
+    const xen_capture_header *header = nullptr;
+    size_t first = exits.size();
+    size_t offset = 0;
+
+    auto finish = [&] {
+        // A truncated log may have been cut off part way through its last
+        // exit, so that exit is not replayed.
+        if (header != nullptr && (header->flags & XEN_CAPTURE_FLAG_TRUNCATED) != 0 &&
+            exits.size() > first)
+            exits.pop_back();
+    };
+
+    while (offset + sizeof(xen_capture_rec) <= log.size()) {
+        auto rec = reinterpret_cast<const xen_capture_rec *>(log.data() + offset);
+
+        if (rec->size < sizeof(xen_capture_rec) || offset + rec->size > log.size()) {
+            fprintf(stderr, "%s: bad record at offset %zu\n", path, offset);
+            exit(2);
+        }
+
+        switch (rec->type) {
+        case xen_capture_type_header:
+            finish();
+
+            header = reinterpret_cast<const xen_capture_header *>(rec);
+            first = exits.size();
+
+            if (header->magic != XEN_CAPTURE_MAGIC || header->version != XEN_CAPTURE_VERSION) {
+                fprintf(stderr, "%s: not a version %d capture log\n", path, XEN_CAPTURE_VERSION);
+                exit(2);
+            }
+            break;
+
+        case xen_capture_type_exit:
+            if (header == nullptr)
+                break;
+
+            exits.push_back({header->vcpuid, reinterpret_cast<const xen_capture_exit *>(rec), {}});
+            break;
+
+        case xen_capture_type_mem: {
+            auto mem = reinterpret_cast<const xen_capture_mem *>(rec);
+            auto data = reinterpret_cast<const uint8_t *>(mem + 1);
+
+            if (exits.size() == first)
+                break;
+
+            exits.back().regions.push_back({mem->gva, {data, data + mem->len}, {}, false});
+            break;
+        }
+
+        default:
+            break;
+        }
+
+        offset += rec->size;
+    }
+
+    finish();
+}
+
+static std::string exit_name(const xen_capture_exit *rec)
+{
+    switch (rec->reason) {
+    case vmcs::exit_reason::basic_exit_reason::cpuid:
+        return "cpuid";
+    case vmcs::exit_reason::basic_exit_reason::hlt:
+        return "hlt";
+    case vmcs::exit_reason::basic_exit_reason::vmcall:
+        return "vmcall:" + std::to_string(rec->regs[xen_capture_rax]);
+    case vmcs::exit_reason::basic_exit_reason::rdmsr:
+        return "rdmsr";
+    case vmcs::exit_reason::basic_exit_reason::wrmsr:
+        return "wrmsr";
+    default:
+        return "reason:" + std::to_string(rec->reason);
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    std::vector<std::vector<uint8_t>> logs;
+    std::vector<replay_exit> exits;
+    std::map<std::string, replay_result> results;
+    unsigned long iterations = 1;
+    uint64_t failed = 0;
+    int arg = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        iterations = strtoul(argv[2], nullptr, 0);
+        arg = 3;
+    }
+
+    if (arg >= argc) {
+        fprintf(stderr, "usage: %s [-n iterations] log...\n", argv[0]);
+        return 2;
+    }
+
+    for (; arg < argc; arg++) {
+        logs.push_back(read_file(argv[arg]));
+        parse_log(logs.back(), argv[arg], exits);
+    }
+
+    // vCPUs are interleaved in the order they exited.
+    std::stable_sort(exits.begin(), exits.end(), [](const replay_exit &a, const replay_exit &b)
+    { return a.rec->tsc < b.rec->tsc; });
+
+    replay_memory memory;
+    mock::guest() = &memory;
+
+    for (auto i = 0UL; i < iterations; i++) {
+        // Every iteration starts from a fresh domain, as the log does.
+        auto domain = std::make_unique<xen_domain>();
+        std::map<uint64_t, std::unique_ptr<replay_vcpu>> vcpus;
+
+        for (auto &&exit : exits) {
+            auto &&vcpu = vcpus[exit.vcpuid];
+
+            if (!vcpu)
+                vcpu = std::make_unique<replay_vcpu>(exit.vcpuid, domain.get());
+
+            vcpu->load(exit.rec);
+            memory.begin(exit);
+
+            auto start = rdtsc_ordered();
+            try {
+                vcpu->handler.handle_exit(exit.rec->reason);
+            }
+            catch (...) {
+                failed++;
+            }
+            auto elapsed = rdtsc_ordered() - start;
+
+            auto &&result = results[exit_name(exit.rec)];
+            result.count++;
+            result.cycles += elapsed;
+        }
+    }
+
+    printf("exit,count,cycles_per_exit\n");
+
+    for (auto &&result : results) {
+        printf("%s,%llu,%llu\n", result.first.c_str(),
+               static_cast<unsigned long long>(result.second.count),
+               static_cast<unsigned long long>(result.second.cycles / result.second.count));
+    }
+
+    fprintf(stderr, "%zu exits x %lu iterations, %llu threw, %llu uncaptured mappings\n",
+            exits.size(), iterations, static_cast<unsigned long long>(failed),
+            static_cast<unsigned long long>(memory.missed()));
+
+    return 0;
+}
@@ -66,6 +66,26 @@ NATIVE_OUTDIR+=%BUILD_REL%/../bin
 ################################################################################
 
 SOURCES+=xen_exit_handler.cpp
+SOURCES+=xen_domain.cpp
+SOURCES+=xen_memory_op.cpp
+SOURCES+=xen_mmuext_op.cpp
+SOURCES+=xen_physmap.cpp
+SOURCES+=xen_evtchn.cpp
+SOURCES+=xen_event_channel_op.cpp
+SOURCES+=xen_tbuf.cpp
+SOURCES+=xen_log.cpp
+SOURCES+=xen_capture.cpp
+SOURCES+=xen_oprof.cpp
+SOURCES+=xen_xenoprof_op.cpp
+SOURCES+=xen_vcpu_pool.cpp
+SOURCES+=xen_msr.cpp
+SOURCES+=xen_cpuid.cpp
+SOURCES+=xen_vcpu_op.cpp
+SOURCES+=xen_time.cpp
+SOURCES+=xen_runstate.cpp
+SOURCES+=xen_timer.cpp
+SOURCES+=xen_sched_op.cpp
+SOURCES+=xen_hvm_op.cpp
 
 INCLUDE_PATHS+=%HYPER_ABS%/include/
 INCLUDE_PATHS+=%HYPER_ABS%/bfvmm/include/
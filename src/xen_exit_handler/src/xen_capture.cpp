@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cstring>
+#include <exit_handler/xen_capture.h>
+#include <exit_handler/xen_exit_handler.h>
+
+#ifdef XEN_EXIT_CAPTURE
+
+#define XEN_CAPTURE_SIZE (XEN_CAPTURE_PAGES * PAGE_SIZE)
+
+static uint64_t align8(uint64_t size)
+{ return (size + 7) & ~7ULL; }
+
+xen_capture::xen_capture(uint64_t vcpuid, const std::atomic<uint64_t> &generation) :
+    m_vcpuid(vcpuid),
+    m_generation(generation),
+    m_len(0),
+    m_log_generation(0),
+    m_active(false),
+    m_stopped(false)
+{ }
+
+void *xen_capture::reserve(xen_capture_type type, uint64_t size)
+{
+    auto len = m_len.load(std::memory_order_relaxed);
+    auto rec = reinterpret_cast<xen_capture_rec *>(m_buf.get() + len);
+
+    rec->type = type;
+    rec->size = static_cast<uint32_t>(align8(size));
+
+    return rec;
+}
+
+void xen_capture::truncate()
+{
+    auto header = reinterpret_cast<xen_capture_header *>(m_buf.get());
+
+    header->flags |= XEN_CAPTURE_FLAG_TRUNCATED;
+    m_stopped = true;
+    m_active = false;
+}
+
+void xen_capture::begin(uint64_t reason, const uint64_t (&regs)[xen_capture_num_regs],
+                        uint64_t cr3, uint64_t pat)
+{
+    auto generation = m_generation.load(std::memory_order_acquire);
+
+    if (generation != m_log_generation) {
+        if (!m_buf)
+            m_buf = std::make_unique<uint8_t[]>(XEN_CAPTURE_SIZE);
+
+        m_len.store(0, std::memory_order_release);
+        m_log_generation = generation;
+        m_stopped = false;
+
+        auto header = static_cast<xen_capture_header *>(reserve(xen_capture_type_header,
+                                                                 sizeof(xen_capture_header)));
+        header->magic = XEN_CAPTURE_MAGIC;
+        header->version = XEN_CAPTURE_VERSION;
+        header->flags = 0;
+        header->vcpuid = m_vcpuid;
+
+        m_len.store(header->rec.size, std::memory_order_release);
+    }
+
+    if (m_stopped)
+        return;
+
+    if (m_len.load(std::memory_order_relaxed) + XEN_CAPTURE_EXIT_RESERVE > XEN_CAPTURE_SIZE) {
+        truncate();
+        return;
+    }
+
+    auto exit = static_cast<xen_capture_exit *>(reserve(xen_capture_type_exit,
+                                                         sizeof(xen_capture_exit)));
+    exit->tsc = rdtsc();
+    exit->reason = reason;
+    exit->guest_cr3 = cr3;
+    exit->guest_ia32_pat = pat;
+    memcpy(exit->regs, regs, sizeof(exit->regs));
+
+    m_len.fetch_add(exit->rec.size, std::memory_order_release);
+    m_active = true;
+}
+
+void xen_capture::record_memory(uint64_t gva, const void *data, uint64_t len)
+{
+    auto size = sizeof(xen_capture_mem) + len;
+
+    if (m_len.load(std::memory_order_relaxed) + align8(size) > XEN_CAPTURE_SIZE) {
+        truncate();
+        return;
+    }
+
+    auto mem = static_cast<xen_capture_mem *>(reserve(xen_capture_type_mem, size));
+    mem->gva = gva;
+    mem->len = len;
+    memcpy(mem + 1, data, len);
+
+    m_len.fetch_add(mem->rec.size, std::memory_order_release);
+}
+
+uint64_t xen_capture::read(uint64_t offset, void *dst, uint64_t len) const
+{
+    auto end = m_len.load(std::memory_order_acquire);
+
+    if (!m_buf || offset >= end)
+        return 0;
+
+    len = std::min(len, end - offset);
+    memcpy(dst, m_buf.get() + offset, len);
+
+    return len;
+}
+
+#endif
@@ -0,0 +1,87 @@
+#include <exit_handler/xen_cpuid.h>
+
+static xen_cpuid_result cpuid(uint32_t leaf, uint32_t subleaf)
+{
+    xen_cpuid_result result;
+
+    asm volatile ("cpuid"
+                  : "=a" (result.eax), "=b" (result.ebx), "=c" (result.ecx), "=d" (result.edx)
+                  : "a" (leaf), "c" (subleaf));
+    return result;
+}
+
+// The leaves whose results depend on the subleaf in ecx.
+static bool has_subleaves(uint32_t leaf)
+{
+    switch (leaf) {
+    case 0x4:
+    case 0x7:
+    case 0xB:
+    case 0xD:
+    case 0xF:
+    case 0x10:
+    case 0x12:
+    case 0x14:
+    case 0x17:
+    case 0x18:
+    case 0x1B:
+    case 0x1D:
+    case 0x1E:
+    case 0x1F:
+    case 0x8000001D:
+    case 0x80000020:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+xen_cpuid_cache::xen_cpuid_cache() :
+    m_slots(),
+    m_results(),
+    m_used(0),
+    m_xsave_stale(false)
+{
+    fill_range(0);
+    fill_range(0x80000000U);
+}
+
+// Leaves above the range's maximum, which the CPU answers with the
+// highest basic leaf's results, are left to the CPU.
+void xen_cpuid_cache::fill_range(uint32_t first_leaf)
+{
+    auto max_leaf = cpuid(first_leaf, 0).eax;
+
+    if (max_leaf < first_leaf)
+        return;
+
+    for (auto leaf = first_leaf; leaf <= max_leaf; leaf++) {
+        auto index = slot_index(leaf);
+
+        if (index >= m_slots.size())
+            break;
+
+        auto indexed = has_subleaves(leaf);
+        auto count = indexed ? XEN_CPUID_SUBLEAVES : 1U;
+
+        if (m_used + count > m_results.size())
+            break;
+
+        for (auto subleaf = 0U; subleaf < count; subleaf++)
+            m_results[m_used + subleaf] = cpuid(leaf, subleaf);
+
+        m_slots[index] = {static_cast<uint8_t>(m_used), static_cast<uint8_t>(count), indexed};
+        m_used += count;
+    }
+}
+
+void xen_cpuid_cache::refill_xsave()
+{
+    auto &&slot = m_slots[XEN_CPUID_XSAVE_LEAF];
+
+    for (auto subleaf = 0U; subleaf < slot.count; subleaf++)
+        m_results[slot.first + subleaf] = cpuid(XEN_CPUID_XSAVE_LEAF, subleaf);
+
+    m_xsave_stale = false;
+}
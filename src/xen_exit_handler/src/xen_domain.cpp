@@ -0,0 +1,311 @@
+#include <exit_handler/xen_domain.h>
+#include <exit_handler/xen_exit_handler.h>
+#include <exit_handler/xen_errno.h>
+#include <exit_handler/xen_hvm_op.h>
+#include <exit_handler/xen_memory.h>
+#include <exit_handler/xen_sched.h>
+#include <memory_manager/memory_manager_x64.h>
+
+static_assert(sizeof(xen_stats_page) == PAGE_SIZE, "xen_stats_page must fill one page");
+
+static std::unique_ptr<uint8_t[]> alloc_domain_page(uintptr_t &maddr)
+{
+    auto page = std::make_unique<uint8_t[]>(PAGE_SIZE);
+
+    memset(page.get(), 0, PAGE_SIZE);
+    maddr = g_mm->virtptr_to_physint(page.get());
+
+    return page;
+}
+
+xen_domain::xen_domain(const xen_domain_info &info) :
+    m_physmap(info.nr_pages, info.max_pages),
+    m_evtchn(this),
+    m_tbuf(m_evtchn),
+    m_oprof(m_evtchn)
+{
+    m_shared_info_page = alloc_domain_page(m_shared_info_maddr);
+    m_store_page = alloc_domain_page(m_store_maddr);
+    m_console_page = alloc_domain_page(m_console_maddr);
+    m_stats_page_mem = alloc_domain_page(m_stats_page_maddr);
+
+    m_shared_info = reinterpret_cast<shared_info_t *>(m_shared_info_page.get());
+
+    m_stats_page = reinterpret_cast<xen_stats_page *>(m_stats_page_mem.get());
+    m_stats_page->magic = XEN_STATS_PAGE_MAGIC;
+    m_stats_page->version = XEN_STATS_PAGE_VERSION;
+    memset(&m_stats_overflow, 0, sizeof(m_stats_overflow));
+
+    auto tsc = rdtsc();
+    for (auto vcpuid = 0U; vcpuid < MAX_VIRT_CPUS; vcpuid++)
+        publish_time(m_shared_info->vcpu_info[vcpuid].time, tsc);
+
+    init_start_info(info);
+}
+
+void xen_domain::init_start_info(const xen_domain_info &info)
+{
+    memset(&m_start_info, 0, sizeof(m_start_info));
+    strncpy(m_start_info.magic, XEN_START_INFO_MAGIC, sizeof(m_start_info.magic) - 1);
+
+    m_start_info.nr_pages = info.nr_pages;
+    m_start_info.shared_info = m_shared_info_maddr;
+    m_start_info.flags = info.flags;
+
+    m_start_info.store_mfn = m_store_maddr >> 12;
+    m_start_info.store_evtchn = XEN_STORE_EVTCHN;
+    m_start_info.console.domU.mfn = m_console_maddr >> 12;
+    m_start_info.console.domU.evtchn = XEN_CONSOLE_EVTCHN;
+
+    m_start_info.mfn_list = info.mfn_list;
+    m_start_info.first_p2m_pfn = info.first_p2m_pfn;
+    m_start_info.nr_p2m_frames = info.nr_p2m_frames;
+}
+
+void xen_domain::prewarm(uint64_t nr_vcpus)
+{
+    for (auto vcpuid = 0UL; vcpuid < nr_vcpus; vcpuid++) {
+        m_tbuf.ring(vcpuid);
+        m_oprof.ring(vcpuid);
+    }
+}
+
+xen_stats_vcpu *xen_domain::stats_vcpu(uint64_t vcpuid)
+{
+    if (vcpuid >= XEN_STATS_PAGE_VCPUS)
+        return &m_stats_overflow;
+
+    if (vcpuid >= m_stats_page->nr_vcpus)
+        m_stats_page->nr_vcpus = static_cast<uint32_t>(vcpuid + 1);
+
+    return &m_stats_page->vcpu[vcpuid];
+}
+
+long xen_domain::add_to_physmap(unsigned int space, xen_ulong_t idx, xen_pfn_t gpfn)
+{
+    switch (space) {
+    case XENMAPSPACE_shared_info:
+        return idx == 0 ? map_shared_info(gpfn) : -XEN_EINVAL;
+
+    case XENMAPSPACE_grant_table:
+        return map_grant_frame(idx, gpfn);
+
+    default:
+        return -XEN_ENOSYS;
+    }
+}
+
+/*
+ * shared_info moves to the guest's frame with its contents. As in
+ * remove_from_physmap, the mapping it moves out of is only dropped at the
+ * next move, as another vCPU may still be writing through it.
+ */
+long xen_domain::map_shared_info(xen_pfn_t gpfn)
+{
+    if ((gpfn << 12) == m_shared_info_maddr)
+        return 0;
+
+    auto &&map = bfn::make_unique_map_x64<uint8_t>(gpfn << 12);
+    auto shared_info = reinterpret_cast<shared_info_t *>(map.get());
+
+    memcpy(shared_info, m_shared_info, sizeof(shared_info_t));
+    __atomic_store_n(&m_shared_info, shared_info, __ATOMIC_RELEASE);
+
+    if (m_shared_info_map)
+        m_shared_info_retired = std::move(m_shared_info_map);
+
+    m_shared_info_map = std::move(map);
+    m_shared_info_maddr = gpfn << 12;
+    m_start_info.shared_info = m_shared_info_maddr;
+
+    return 0;
+}
+
+long xen_domain::map_grant_frame(xen_ulong_t idx, xen_pfn_t gpfn)
+{
+    // Only v1 grant tables are supported, which have no status frames.
+    if ((idx & XENMAPIDX_grant_table_status) != 0)
+        return -XEN_EINVAL;
+
+    if (idx >= XEN_MAX_GRANT_FRAMES)
+        return -XEN_EINVAL;
+
+    auto &&map = bfn::make_unique_map_x64<uint8_t>(gpfn << 12);
+
+    memset(map.get(), 0, PAGE_SIZE);
+    m_grant_frames[idx] = std::move(map);
+    m_grant_gpfns[idx] = gpfn;
+
+    return 0;
+}
+
+/*
+ * Hands a frame placed by add_to_physmap back to the guest, which must do
+ * this before it frees it. shared_info moves back into the hypervisor's own
+ * frame with its contents. Its old mapping is only dropped at the next
+ * removal, as another vCPU may still be writing through it.
+ */
+long xen_domain::remove_from_physmap(xen_pfn_t gpfn)
+{
+    if (m_shared_info_map && gpfn == m_shared_info_maddr >> 12) {
+        auto shared_info = reinterpret_cast<shared_info_t *>(m_shared_info_page.get());
+
+        memcpy(shared_info, m_shared_info, sizeof(shared_info_t));
+        __atomic_store_n(&m_shared_info, shared_info, __ATOMIC_RELEASE);
+
+        m_shared_info_retired = std::move(m_shared_info_map);
+        m_shared_info_maddr = g_mm->virtptr_to_physint(shared_info);
+        m_start_info.shared_info = m_shared_info_maddr;
+
+        return 0;
+    }
+
+    for (auto idx = 0U; idx < XEN_MAX_GRANT_FRAMES; idx++) {
+        if (m_grant_frames[idx] && m_grant_gpfns[idx] == gpfn) {
+            m_grant_frames[idx] = bfn::unique_map_ptr_x64<uint8_t>();
+            return 0;
+        }
+    }
+
+    return -XEN_ENOENT;
+}
+
+/*
+ * As in Xen, a vCPU's vcpu_info can be moved once, and may not cross a
+ * page. The current contents are carried over. Any event set in the old
+ * copy while it moves would be missed, so every selector bit is set and
+ * an upcall made pending, which has the guest rescan evtchn_pending. Two
+ * vCPUs registering the same vCPU at once are serialized, and the second
+ * fails.
+ */
+long xen_domain::register_vcpu_info(uint64_t vcpuid, xen_pfn_t gpfn, uint32_t offset)
+{
+    if (vcpuid >= XEN_MAX_VCPUS)
+        return -XEN_ENOENT;
+
+    if (offset > PAGE_SIZE - sizeof(struct vcpu_info))
+        return -XEN_EINVAL;
+
+    std::lock_guard<std::mutex> lock(m_vcpu_info_mutex);
+
+    if (m_vcpu_info[vcpuid] != nullptr)
+        return -XEN_EINVAL;
+
+    auto &&map = bfn::make_unique_map_x64<uint8_t>(gpfn << 12);
+    auto info = reinterpret_cast<struct vcpu_info *>(map.get() + offset);
+    auto old = vcpu_info(vcpuid);
+
+    if (old != nullptr) {
+        memcpy(info, old, sizeof(*info));
+    }
+    else {
+        memset(info, 0, sizeof(*info));
+        publish_time(info->time, rdtsc());
+    }
+
+    m_vcpu_info_maps[vcpuid] = std::move(map);
+    __atomic_store_n(&m_vcpu_info[vcpuid], info, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&info->evtchn_pending_sel, ~0UL, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&info->evtchn_upcall_pending, 1, __ATOMIC_SEQ_CST);
+
+    return 0;
+}
+
+void xen_domain::update_time(uint64_t vcpuid, uint64_t tsc)
+{
+    auto info = vcpu_info(vcpuid);
+
+    if (info != nullptr)
+        publish_time(info->time, tsc);
+}
+
+/*
+ * As in Xen, the version is odd while the other fields are written, which
+ * a guest reading them on another CPU retries on. x86 keeps the stores in
+ * order, so only the compiler needs fencing.
+ */
+void xen_domain::publish_time(struct pvclock_vcpu_time_info &time, uint64_t tsc)
+{
+    time.version++;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    time.tsc_timestamp = tsc;
+    time.system_time = m_clock.ns(tsc);
+    time.tsc_to_system_mul = m_clock.tsc_to_system_mul();
+    time.tsc_shift = static_cast<uint8_t>(m_clock.tsc_shift());
+
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    time.version++;
+}
+
+// Of the assists, HVM guests only have the runstate update flag.
+long xen_domain::vm_assist(unsigned long cmd, unsigned long type)
+{
+    if (type != VMASST_TYPE_runstate_update_flag)
+        return -XEN_EINVAL;
+
+    switch (cmd) {
+    case VMASST_CMD_enable:
+        m_runstate_update_flag = true;
+        return 0;
+
+    case VMASST_CMD_disable:
+        m_runstate_update_flag = false;
+        return 0;
+
+    default:
+        return -XEN_ENOSYS;
+    }
+}
+
+// Vectors below 0x20 are exceptions, which an upcall must not look like.
+long xen_domain::set_callback_irq(uint64_t val)
+{
+    auto type = val >> HVM_PARAM_CALLBACK_TYPE_SHIFT;
+    auto vector = val & 0xFF;
+
+    if (val == 0) {
+        m_callback_vector = 0;
+        return 0;
+    }
+
+    if (type != HVM_PARAM_CALLBACK_TYPE_VECTOR || vector < 0x20 ||
+        (val & ((1ULL << HVM_PARAM_CALLBACK_TYPE_SHIFT) - 1)) != vector)
+        return -XEN_EINVAL;
+
+    m_callback_vector = static_cast<uint8_t>(vector);
+    return 0;
+}
+
+uint64_t xen_domain::callback_irq() const
+{
+    auto vector = callback_vector();
+
+    if (vector == 0)
+        return 0;
+
+    return static_cast<uint64_t>(HVM_PARAM_CALLBACK_TYPE_VECTOR) << HVM_PARAM_CALLBACK_TYPE_SHIFT | vector;
+}
+
+void xen_domain::wake(uint64_t vcpuid)
+{
+    auto wait = vcpuid < XEN_MAX_VCPUS ? m_waits[vcpuid] : nullptr;
+
+    if (wait == nullptr || !wait->wake(rdtsc()) || m_kick == nullptr)
+        return;
+
+    wait->set_kick();
+    m_kick(m_apic_ids[vcpuid]);
+}
+
+// The guest cannot be torn down from under it, so its shutdown is only
+// recorded, and it carries on with its own power-off or reboot path.
+long xen_domain::shutdown(unsigned int reason)
+{
+    if (reason > SHUTDOWN_MAX)
+        return -XEN_EINVAL;
+
+    m_shutdown_reason = static_cast<int>(reason);
+    return 0;
+}
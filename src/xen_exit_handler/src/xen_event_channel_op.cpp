@@ -0,0 +1,49 @@
+#include <exit_handler/xen_exit_handler.h>
+#include <exit_handler/xen_domain.h>
+#include <xen.h>
+#include <xen_errno.h>
+#include <xen_event_channel.h>
+#include <xen_hypercalls.h>
+
+long xen_exit_handler::handle_event_channel_op(vmcall_registers_t &regs)
+{
+    auto &&evtchn = m_domain->evtchn();
+
+    switch (regs.r01) {
+    case xen_hypercall::event_channel_op_cmd::bind_virq: {
+        auto imap = map_guest<evtchn_bind_virq>(regs.r02);
+        auto op = imap.get();
+
+        return evtchn.bind_virq(op->virq, op->vcpu, op->port);
+    }
+
+    case xen_hypercall::event_channel_op_cmd::bind_ipi: {
+        auto imap = map_guest<evtchn_bind_ipi>(regs.r02);
+        auto op = imap.get();
+
+        return evtchn.bind_ipi(op->vcpu, op->port);
+    }
+
+    case xen_hypercall::event_channel_op_cmd::close: {
+        auto imap = map_guest<evtchn_close>(regs.r02);
+
+        return evtchn.close(imap.get()->port);
+    }
+
+    case xen_hypercall::event_channel_op_cmd::send: {
+        auto imap = map_guest<evtchn_send>(regs.r02);
+
+        update_stats([](auto &stats) { stats.event_sends++; });
+        return evtchn.send(imap.get()->port);
+    }
+
+    case xen_hypercall::event_channel_op_cmd::unmask: {
+        auto imap = map_guest<evtchn_unmask>(regs.r02);
+
+        return evtchn.unmask(imap.get()->port);
+    }
+
+    default:
+        return -XEN_ENOSYS;
+    }
+}
@@ -0,0 +1,206 @@
+#include <exit_handler/xen_evtchn.h>
+#include <exit_handler/xen_domain.h>
+#include <exit_handler/xen_errno.h>
+
+#define BITS_PER_XEN_ULONG (sizeof(xen_ulong_t) * 8)
+
+static bool test_and_set_bit(unsigned long nr, xen_ulong_t *addr)
+{
+    auto mask = 1UL << (nr % BITS_PER_XEN_ULONG);
+    return (__atomic_fetch_or(&addr[nr / BITS_PER_XEN_ULONG], mask, __ATOMIC_SEQ_CST) & mask) != 0;
+}
+
+static bool test_and_clear_bit(unsigned long nr, xen_ulong_t *addr)
+{
+    auto mask = 1UL << (nr % BITS_PER_XEN_ULONG);
+    return (__atomic_fetch_and(&addr[nr / BITS_PER_XEN_ULONG], ~mask, __ATOMIC_SEQ_CST) & mask) != 0;
+}
+
+static bool test_bit(unsigned long nr, const xen_ulong_t *addr)
+{
+    auto mask = 1UL << (nr % BITS_PER_XEN_ULONG);
+    return (__atomic_load_n(&addr[nr / BITS_PER_XEN_ULONG], __ATOMIC_SEQ_CST) & mask) != 0;
+}
+
+static bool is_per_vcpu_virq(uint32_t virq)
+{
+    switch (virq) {
+    case VIRQ_TIMER:
+    case VIRQ_DEBUG:
+    case VIRQ_XENOPROF:
+    case VIRQ_XENPMU:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+xen_evtchn::xen_evtchn(xen_domain *domain) :
+    m_domain(domain),
+    m_ports(),
+    m_virq_ports()
+{
+    m_ports[XEN_STORE_EVTCHN].state = port_reserved;
+    m_ports[XEN_CONSOLE_EVTCHN].state = port_reserved;
+}
+
+long xen_evtchn::alloc_port(port_state state, uint32_t virq, uint32_t vcpu, evtchn_port_t &port)
+{
+    // Port 0 is never valid.
+    for (auto i = 1U; i < XEN_EVTCHN_PORTS; i++) {
+        if (m_ports[i].state != port_free)
+            continue;
+
+        m_ports[i].state = state;
+        m_ports[i].virq = static_cast<uint8_t>(virq);
+        m_ports[i].vcpu = vcpu;
+
+        port = i;
+        return 0;
+    }
+
+    return -XEN_ENOSPC;
+}
+
+long xen_evtchn::bind_virq(uint32_t virq, uint32_t vcpu, evtchn_port_t &port)
+{
+    if (virq >= NR_VIRQS || vcpu >= XEN_MAX_VCPUS)
+        return -XEN_EINVAL;
+
+    // Global VIRQs are always bound on vCPU 0 first (EVTCHNOP_bind_vcpu,
+    // which would move them, is not supported).
+    if (!is_per_vcpu_virq(virq) && vcpu != 0)
+        return -XEN_EINVAL;
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_virq_ports[vcpu][virq] != 0)
+        return -XEN_EEXIST;
+
+    auto ret = alloc_port(port_virq, virq, vcpu, port);
+
+    if (ret == 0)
+        m_virq_ports[vcpu][virq] = port;
+
+    return ret;
+}
+
+long xen_evtchn::bind_ipi(uint32_t vcpu, evtchn_port_t &port)
+{
+    if (vcpu >= XEN_MAX_VCPUS)
+        return -XEN_ENOENT;
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    return alloc_port(port_ipi, 0, vcpu, port);
+}
+
+long xen_evtchn::close(evtchn_port_t port)
+{
+    if (port >= XEN_EVTCHN_PORTS)
+        return -XEN_EINVAL;
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto &&info = m_ports[port];
+
+    switch (info.state) {
+    case port_free:
+        return -XEN_EINVAL;
+
+    case port_virq:
+        m_virq_ports[info.vcpu][info.virq] = 0;
+        break;
+
+    default:
+        break;
+    }
+
+    info = port_info();
+
+    // Xen returns the reserved ports to the unbound state rather than
+    // freeing them; keep them out of the allocator the same way.
+    if (port == XEN_STORE_EVTCHN || port == XEN_CONSOLE_EVTCHN)
+        info.state = port_reserved;
+
+    return 0;
+}
+
+// As in Xen, a send on an unbound port (here the reserved store and console
+// ports) is dropped, and one on a VIRQ port is an error.
+long xen_evtchn::send(evtchn_port_t port)
+{
+    if (port >= XEN_EVTCHN_PORTS)
+        return -XEN_EINVAL;
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto &&info = m_ports[port];
+
+    switch (info.state) {
+    case port_ipi:
+        set_pending(port, info.vcpu);
+        return 0;
+
+    case port_reserved:
+        return 0;
+
+    default:
+        return -XEN_EINVAL;
+    }
+}
+
+long xen_evtchn::unmask(evtchn_port_t port)
+{
+    if (port >= XEN_EVTCHN_PORTS)
+        return -XEN_EINVAL;
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto shared_info = m_domain->shared_info();
+    auto vcpu_info = m_domain->vcpu_info(m_ports[port].vcpu);
+
+    // Deliver an event that arrived while the port was masked.
+    if (test_and_clear_bit(port, shared_info->evtchn_mask) &&
+        test_bit(port, shared_info->evtchn_pending) && vcpu_info != nullptr &&
+        !test_and_set_bit(port / BITS_PER_XEN_ULONG, &vcpu_info->evtchn_pending_sel)) {
+        __atomic_store_n(&vcpu_info->evtchn_upcall_pending, 1, __ATOMIC_SEQ_CST);
+        m_domain->wake(m_ports[port].vcpu);
+    }
+
+    return 0;
+}
+
+bool xen_evtchn::raise_virq(uint32_t virq, uint64_t vcpu)
+{
+    if (virq >= NR_VIRQS || vcpu >= XEN_MAX_VCPUS)
+        return false;
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto port = m_virq_ports[vcpu][virq];
+
+    if (port == 0)
+        return false;
+
+    set_pending(port, m_ports[port].vcpu);
+    return true;
+}
+
+void xen_evtchn::set_pending(evtchn_port_t port, uint32_t vcpu)
+{
+    auto shared_info = m_domain->shared_info();
+    auto vcpu_info = m_domain->vcpu_info(vcpu);
+
+    if (test_and_set_bit(port, shared_info->evtchn_pending))
+        return;
+
+    if (test_bit(port, shared_info->evtchn_mask) || vcpu_info == nullptr)
+        return;
+
+    if (!test_and_set_bit(port / BITS_PER_XEN_ULONG, &vcpu_info->evtchn_pending_sel)) {
+        __atomic_store_n(&vcpu_info->evtchn_upcall_pending, 1, __ATOMIC_SEQ_CST);
+        m_domain->wake(vcpu);
+    }
+}
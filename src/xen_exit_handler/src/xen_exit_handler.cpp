@@ -1,22 +1,27 @@
+#include <algorithm>
+#include <iterator>
 #include <exit_handler/xen_exit_handler.h>
+#include <vmcs/vmcs_intel_x64_16bit_guest_state_fields.h>
+#include <vmcs/vmcs_intel_x64_32bit_control_fields.h>
 #include <vmcs/vmcs_intel_x64_32bit_guest_state_fields.h>
 #include <vmcs/vmcs_intel_x64_32bit_read_only_data_fields.h>
+#include <vmcs/vmcs_intel_x64_64bit_control_fields.h>
 #include <vmcs/vmcs_intel_x64_natural_width_guest_state_fields.h>
 #include <vmcs/vmcs_intel_x64_natural_width_read_only_data_fields.h>
 #include <vmcs/vmcs_intel_x64_64bit_guest_state_fields.h>
 #include <vmcs/vmcs_intel_x64_check.h>
 #include <vmcs/vmcs_intel_x64_debug.h>
 #include <exit_handler/exit_handler_intel_x64.h>
+#include <exit_handler/xen_domain.h>
+#include <exit_handler/xen_vcpu_pool.h>
 #include <test_hypercalls.h>
 #include <xen.h>
+#include <xen_errno.h>
 #include <xen_hypercalls.h>
+#include <xen_vcpu.h>
 
 using namespace intel_x64;
 
-shared_info_t *shared_info = NULL;
-uintptr_t shared_info_addr = 0;
-unsigned int tsc_khz;
-
 uint64_t rdtsc(void)
 {
     unsigned int low, high;
@@ -27,58 +32,236 @@ uint64_t rdtsc(void)
     return low | static_cast<uint64_t>(high) << 32;
 }
 
-void init_hypercall_page(void *hypercall_page)
+// A 32-byte stub per hypercall that loads the hypercall number and makes a
+// vmcall. As Xen does for HVM guests, the iret slot is a ud2: the guest
+// runs its own interrupt returns, so nothing should jump there.
+struct xen_hypercall_page_template
 {
-    uint8_t *p;
-    uint32_t i;
+    uint8_t bytes[PAGE_SIZE];
+};
+
+static constexpr xen_hypercall_page_template make_hypercall_page_template()
+{
+    xen_hypercall_page_template page = {};
+
+    for (uint32_t i = 0; i < PAGE_SIZE / 32; i++) {
+        auto p = &page.bytes[i * 32];
 
-    for (i = 0; i < (PAGE_SIZE / 32); i++) {
-            if (i == 23) // skip iret
-                continue;
+        if (i == xen_hypercall::iret) {
+            p[0] = 0x0f; /* ud2 */
+            p[1] = 0x0b;
+            continue;
+        }
 
-            p = (static_cast<uint8_t*>(hypercall_page) + (i * 32));
-            *static_cast<uint8_t*>(p + 0) = 0xb8; /* mov imm32, %eax */
-            *reinterpret_cast<uint32_t*>(p + 1) = i;
-            *static_cast<uint8_t*>(p + 5) = 0x0f; /* vmcall */
-            *static_cast<uint8_t*>(p + 6) = 0x01;
-            *static_cast<uint8_t*>(p + 7) = 0xc1;
-            *static_cast<uint8_t*>(p + 8) = 0xc3; /* ret */
+        p[0] = 0xb8; /* mov imm32, %eax */
+        p[1] = static_cast<uint8_t>(i);
+        p[5] = 0x0f; /* vmcall */
+        p[6] = 0x01;
+        p[7] = 0xc1;
+        p[8] = 0xc3; /* ret */
     }
+
+    return page;
+}
+
+static constexpr const xen_hypercall_page_template g_hypercall_page = make_hypercall_page_template();
+
+void init_hypercall_page(void *hypercall_page)
+{ memcpy(hypercall_page, g_hypercall_page.bytes, PAGE_SIZE); }
+
+static xen_vcpu_pool g_handler_pool;
+
+void xen_exit_handler::reserve(size_t count)
+{ g_handler_pool.reserve(count, sizeof(xen_exit_handler)); }
+
+void *xen_exit_handler::operator new(size_t size)
+{
+    auto ptr = g_handler_pool.alloc(size);
+    return ptr != nullptr ? ptr : ::operator new(size);
+}
+
+void xen_exit_handler::operator delete(void *ptr)
+{
+    if (!g_handler_pool.free(ptr))
+        ::operator delete(ptr);
 }
 
 void xen_exit_handler::handle_exit(intel_x64::vmcs::value_type reason)
 {
+    dispatch_exit<xen_default_policy>(reason);
+}
+
+template<class P>
+void xen_exit_handler::dispatch_exit(intel_x64::vmcs::value_type reason)
+{
+    m_exit_stats.begin(reason, m_state_save->rip);
+
+    auto tsc = rdtsc();
+
+    if (P::pvclock)
+        m_runstate.exit(tsc, m_blocked || reason == vmcs::exit_reason::basic_exit_reason::hlt);
+
+    if (m_capture.enabled())
+        capture_exit(reason);
+
+    update_stats([](auto &stats) { stats.exits++; });
+
+    if (!m_started)
+        start();
+
+    sync_hlt_exiting();
+
+    if (P::tracing)
+        sync_oprof(tsc);
+
+    if (P::timers && tsc >= m_timers.deadline())
+        handle_xen_timers(tsc);
+
+    if (m_blocked)
+        end_block(reason, tsc);
+
+    if (P::tracing && tracing()) {
+        auto rip = m_state_save->rip;
+        uint32_t extra[] = {
+            static_cast<uint32_t>(reason),
+            static_cast<uint32_t>(rip),
+            static_cast<uint32_t>(rip >> 32)
+        };
+
+        m_trace->record(TRC_HVM_VMEXIT64, extra, 3);
+    }
+
     if (reason == vmcs::exit_reason::basic_exit_reason::cpuid) {
             if (m_state_save->rax == 0x40000000) {
                 handle_xen_cpuid();
-                m_vmcs->resume();
+                resume_guest<P>();
+                return;
+            }
+
+            if (handle_cached_cpuid()) {
+                resume_guest<P>();
                 return;
             }
         }
 
+        // Passed on to the base class, which does the xsetbv.
+        else if (reason == vmcs::exit_reason::basic_exit_reason::xsetbv) {
+            m_cpuid.invalidate_xsave();
+        }
+
         else if (reason == vmcs::exit_reason::basic_exit_reason::vmcall) {
             if (m_state_save->rdx != VMCALL_MAGIC_NUMBER) {
-                handle_xen_vmcall();
-                m_vmcs->resume();
+                handle_xen_vmcall<P>();
+                resume_guest<P>();
                 return;
             }
 
         }
 
+        else if (reason == vmcs::exit_reason::basic_exit_reason::hlt) {
+            handle_xen_hlt();
+            resume_guest<P>();
+            return;
+        }
+
+        // Only taken for a pending upcall, which the entry injects.
+        else if (reason == vmcs::exit_reason::basic_exit_reason::interrupt_window) {
+            resume_guest<P>();
+            return;
+        }
+
+        // NMIs only exit in a domain that kicks blocked vCPUs with them.
+        // The block has already ended; anything but a kick is the guest's.
+        else if (reason == vmcs::exit_reason::basic_exit_reason::exception_or_non_maskable_interrupt &&
+                 (vmcs::vm_exit_interruption_information::get() & VM_INTERRUPTION_TYPE_MASK) == VM_INTERRUPTION_TYPE_NMI) {
+            if (!m_wait.take_kick())
+                m_nmi_pending = true;
+
+            resume_guest<P>();
+            return;
+        }
+
+        // Only taken for an NMI handed on to the guest.
+        else if (reason == vmcs::exit_reason::basic_exit_reason::nmi_window) {
+            resume_guest<P>();
+            return;
+        }
+
+        else if (reason == vmcs::exit_reason::basic_exit_reason::preemption_timer_expired) {
+            if (P::tracing)
+                handle_xen_oprof_sample(tsc);
+
+            resume_guest<P>();
+            return;
+        }
+
         else if (reason == vmcs::exit_reason::basic_exit_reason::wrmsr) {
-            if (m_state_save->rcx == 0x40000000) {
+            auto msr = static_cast<uint32_t>(m_state_save->rcx);
+
+            if (msr - XEN_MSR_BASE < XEN_MSR_COUNT) {
                 handle_xen_wrmsr();
-                m_vmcs->resume();
+                resume_guest<P>();
                 return;
             }
+
+            // Passed on to the base class, which does the write.
+            if (msr == MSR_IA32_XSS)
+                m_cpuid.invalidate_xsave();
         }
 
+        // Exits handled by the base class are only timed up to the point
+        // they are handed off, as it resumes the guest itself.
+        prepare_entry<P>();
         exit_handler_intel_x64::handle_exit(reason);
 }
 
+template<class P>
+void xen_exit_handler::resume_guest()
+{
+    prepare_entry<P>();
+    m_vmcs->resume();
+}
+
+// Only the profiler, the vCPU's timers and SCHEDOP_block use the
+// preemption timer. A vCPU halted in SCHEDOP_block stays blocked.
+template<class P>
+void xen_exit_handler::prepare_entry()
+{
+    auto tsc = rdtsc();
+
+    m_exit_stats.end();
+    m_capture.end();
+    m_vmcs_cache.invalidate();
+
+    if (P::pvclock && !m_blocked)
+        m_runstate.enter(tsc);
+
+    if (m_nmi_pending || m_nmi_window)
+        sync_nmi();
+
+    if (P::event_channels)
+        sync_upcall();
+
+    if (P::tracing || P::timers || m_blocked || m_preemption_timer_armed)
+        sync_preemption_timer(tsc);
+}
+
+void xen_exit_handler::capture_exit(intel_x64::vmcs::value_type reason)
+{
+    uint64_t regs[xen_capture_num_regs] = {
+        m_state_save->rax, m_state_save->rbx, m_state_save->rcx, m_state_save->rdx,
+        m_state_save->rbp, m_state_save->rsi, m_state_save->rdi,
+        m_state_save->r08, m_state_save->r09, m_state_save->r10, m_state_save->r11,
+        m_state_save->r12, m_state_save->r13, m_state_save->r14, m_state_save->r15,
+        m_state_save->rip, m_state_save->rsp
+    };
+
+    m_capture.begin(reason, regs, m_vmcs_cache.guest_cr3(), m_vmcs_cache.guest_ia32_pat());
+}
+
 void xen_exit_handler::handle_xen_cpuid()
 {
-    bfdebug << "Entered correctly" << bfendl;
+    xen_log_debug(xen_log_cpuid_leaves);
     m_state_save->rax = XEN_CPUID_FIRST_LEAF + XEN_CPUID_MAX_NUM_LEAVES;
     m_state_save->rbx = 0x566e6558;
     m_state_save->rcx = 0x65584d4d;
@@ -86,6 +269,58 @@ void xen_exit_handler::handle_xen_cpuid()
     advance_rip();
 }
 
+// Served from the vCPU's cache, with the bits that reflect the guest's CR4
+// set from it. Returns false for anything the cache does not hold.
+bool xen_exit_handler::handle_cached_cpuid()
+{
+    auto leaf = static_cast<uint32_t>(m_state_save->rax);
+    auto subleaf = static_cast<uint32_t>(m_state_save->rcx);
+    auto result = m_cpuid.find(leaf, subleaf);
+
+    if (result == nullptr)
+        return false;
+
+    auto ecx = result->ecx;
+
+    if (leaf == 1) {
+        auto osxsave = (m_vmcs_cache.guest_cr4() & CR4_OSXSAVE) != 0;
+        ecx = osxsave ? ecx | CPUID_1_ECX_OSXSAVE : ecx & ~CPUID_1_ECX_OSXSAVE;
+    }
+    else if (leaf == 7 && subleaf == 0) {
+        auto ospke = (m_vmcs_cache.guest_cr4() & CR4_PKE) != 0;
+        ecx = ospke ? ecx | CPUID_7_ECX_OSPKE : ecx & ~CPUID_7_ECX_OSPKE;
+    }
+
+    m_state_save->rax = result->eax;
+    m_state_save->rbx = result->ebx;
+    m_state_save->rcx = ecx;
+    m_state_save->rdx = result->edx;
+    advance_rip();
+
+    return true;
+}
+
+// The runstate and timer vcpu_ops belong to features P may leave out.
+template<class P>
+static bool vcpu_op_enabled(uintptr_t cmd)
+{
+    switch (cmd) {
+    case VCPUOP_register_runstate_memory_area:
+    case VCPUOP_get_runstate_info:
+        return P::pvclock;
+
+    case VCPUOP_set_periodic_timer:
+    case VCPUOP_stop_periodic_timer:
+    case VCPUOP_set_singleshot_timer:
+    case VCPUOP_stop_singleshot_timer:
+        return P::timers;
+
+    default:
+        return true;
+    }
+}
+
+template<class P>
 void xen_exit_handler::handle_xen_vmcall()
 {
     auto &&regs = vmcall_registers_t{};
@@ -100,6 +335,23 @@ void xen_exit_handler::handle_xen_vmcall()
     regs.r05 = m_state_save->r08;
     regs.r06 = m_state_save->r09;
 
+    m_exit_stats.set_hypercall(regs.r00);
+    update_stats([](auto &stats) { stats.hypercalls++; });
+
+    // Xen records at most three 64-bit arguments per hypercall event.
+    if (P::tracing && tracing()) {
+        uint32_t extra[] = {
+            static_cast<uint32_t>(regs.r00 & ~TRC_PV_HYPERCALL_V2_ARG_MASK) |
+                TRC_PV_HYPERCALL_V2_ARG_64(0) | TRC_PV_HYPERCALL_V2_ARG_64(1) |
+                TRC_PV_HYPERCALL_V2_ARG_64(2),
+            static_cast<uint32_t>(regs.r01), static_cast<uint32_t>(regs.r01 >> 32),
+            static_cast<uint32_t>(regs.r02), static_cast<uint32_t>(regs.r02 >> 32),
+            static_cast<uint32_t>(regs.r03), static_cast<uint32_t>(regs.r03 >> 32)
+        };
+
+        m_trace->record(TRC_PV_HYPERCALL_V2, extra, 7);
+    }
+
     auto &&ret = guard_exceptions(BF_VMCALL_FAILURE, [&] {
             switch (m_state_save->rax)
                 {
@@ -108,48 +360,337 @@ void xen_exit_handler::handle_xen_vmcall()
                     init_start_info(regs);
                     break;
 
-                case INIT_SHARED_INFO:
-                    init_shared_info(regs);
+                case SET_BAREFLANK_TIME:
+                    if (P::pvclock)
+                        set_bareflank_time(regs);
+                    else
+                        regs.r00 = static_cast<uintptr_t>(-XEN_ENOSYS);
                     break;
 
-                case SET_BAREFLANK_TIME:
-                    set_bareflank_time(regs);
+                case GET_SCRUB_STATS:
+                    get_scrub_stats(regs);
+                    break;
+
+                case DUMP_EXIT_STATS:
+                    dump_exit_stats(regs);
+                    break;
+
+                case GET_STATS_PAGE:
+                    get_stats_page(regs);
+                    break;
+
+                case TRACE_OP:
+                    if (P::tracing)
+                        trace_op(regs);
+                    else
+                        regs.r00 = static_cast<uintptr_t>(-XEN_ENOSYS);
+                    break;
+
+                case FLUSH_LOG:
+                    flush_log();
+                    break;
+
+                case CAPTURE_OP:
+                    capture_op(regs);
+                    break;
+
+                case DUMP_EXIT_SITES:
+                    dump_exit_sites(regs);
                     break;
 
                 case xen_hypercall::console_io:
-                    handle_vmcall_console_io(regs.r01, regs.r02, regs.r03);
+                    if (P::console == xen_console_mode::debug_ring)
+                        handle_vmcall_console_io(regs.r01, regs.r02, regs.r03);
+                    regs.r00 = 0;
+                    break;
+
+                case xen_hypercall::memory_op:
+                    regs.r00 = static_cast<uintptr_t>(handle_memory_op(regs));
+                    break;
+
+                case xen_hypercall::mmuext_op:
+                    regs.r00 = static_cast<uintptr_t>(handle_mmuext_op(regs));
+                    break;
+
+                case xen_hypercall::event_channel_op:
+                    regs.r00 = P::event_channels ?
+                               static_cast<uintptr_t>(handle_event_channel_op(regs)) :
+                               static_cast<uintptr_t>(-XEN_ENOSYS);
+                    break;
+
+                case xen_hypercall::xenoprof_op:
+                    regs.r00 = P::tracing ?
+                               static_cast<uintptr_t>(handle_xenoprof_op(regs)) :
+                               static_cast<uintptr_t>(-XEN_ENOSYS);
+                    break;
+
+                case xen_hypercall::set_timer_op:
+                    regs.r00 = P::timers ?
+                               static_cast<uintptr_t>(handle_set_timer_op(regs)) :
+                               static_cast<uintptr_t>(-XEN_ENOSYS);
+                    break;
+
+                case xen_hypercall::sched_op:
+                    regs.r00 = static_cast<uintptr_t>(handle_sched_op(regs));
+                    break;
+
+                case xen_hypercall::vm_assist:
+                    regs.r00 = static_cast<uintptr_t>(m_domain->vm_assist(regs.r01, regs.r02));
+                    break;
+
+                case xen_hypercall::hvm_op:
+                    regs.r00 = P::event_channels ?
+                               static_cast<uintptr_t>(handle_hvm_op(regs)) :
+                               static_cast<uintptr_t>(-XEN_ENOSYS);
+                    break;
+
+                case xen_hypercall::vcpu_op:
+                    regs.r00 = vcpu_op_enabled<P>(regs.r01) ?
+                               static_cast<uintptr_t>(handle_vcpu_op(regs)) :
+                               static_cast<uintptr_t>(-XEN_ENOSYS);
                     break;
 
                 case 83:
                     handle_test_vmcall();
                     break;
                 default:
-                    throw std::runtime_error("unknown vmcall opcode");
+                    regs.r00 = static_cast<uintptr_t>(-XEN_ENOSYS);
+                    break;
                 };
         });
-    complete_xen_vmcall(ret, regs);
+    complete_xen_vmcall<P>(ret, regs);
 }
 
+// Indexed by the MSR's offset from XEN_MSR_BASE.
+static void (xen_exit_handler::*const g_xen_wrmsr[XEN_MSR_COUNT])(uint64_t) = {
+    &xen_exit_handler::wrmsr_hypercall_page
+};
+
 void xen_exit_handler::handle_xen_wrmsr()
 {
+    auto msr = static_cast<uint32_t>(m_state_save->rcx);
     auto val = 0ULL;
 
     val |= ((m_state_save->rax & 0x00000000FFFFFFFF) << 0x00);
     val |= ((m_state_save->rdx & 0x00000000FFFFFFFF) << 0x20);
 
-    bfdebug << vmcs::guest_cr3::get() << bfendl;
-    bfdebug << "hypervisor: " << std::hex << val << bfendl;
+    (this->*g_xen_wrmsr[msr - XEN_MSR_BASE])(val);
+    advance_rip();
+}
+
+void xen_exit_handler::wrmsr_hypercall_page(uint64_t val)
+{
+    xen_log_info(xen_log_hypercall_page, val);
+
+    // As in Xen, the value is the guest-physical address of the page, with
+    // the page's index in the low bits. There is only the one page, and it
+    // is only filled in again if it moves.
+    if ((val & (PAGE_SIZE - 1)) == 0 && val != m_hypercall_page) {
+        auto imap = bfn::make_unique_map_x64<uint8_t>(val);
+
+        init_hypercall_page(imap.get());
+        m_hypercall_page = val;
+    }
+}
+
+/*
+ * Done on the vCPU's first exit, as the VMCS is only current, and the
+ * handler only sure to be on the vCPU's own CPU, once the vCPU is running.
+ * If the domain kicks blocked vCPUs, NMIs exit from here on (with virtual
+ * NMIs, so the guest's own can be handed on; see sync_nmi).
+ */
+void xen_exit_handler::start()
+{
+    vmcs::address_of_msr_bitmap::set(m_domain->msr_bitmap().maddr());
+    vmcs::primary_processor_based_vm_execution_controls::use_msr_bitmap::enable();
+
+    if (m_domain->kicks()) {
+        m_domain->register_apic_id(m_vcpuid, x2apic_id());
+        vmcs::pin_based_vm_execution_controls::nmi_exiting::enable();
+        vmcs::pin_based_vm_execution_controls::virtual_nmis::enable();
+    }
+
+    m_started = true;
+}
+
+/*
+ * HLT only exits while there are released frames waiting to be scrubbed.
+ * Each exit zeroes one batch and then completes the HLT, as if an interrupt
+ * had woken the vCPU: an interrupt delivered on entry must return past the
+ * HLT, or a guest that halts outside an STI shadow would halt again and
+ * lose the wakeup. Idle loops check for work and halt again anyway. Once
+ * the queue drains HLT exiting is switched off and the guest halts natively.
+ */
+void xen_exit_handler::handle_xen_hlt()
+{
+    flush_log();
 
-    uintptr_t phys_addr = bfn::virt_to_phys_with_cr3(val, vmcs::guest_cr3::get());
-    auto imap = bfn::make_unique_map_x64<uintptr_t>(phys_addr);
-    uintptr_t *page = imap.get();
+    if (m_domain->physmap().scrub(XEN_SCRUB_BATCH_PAGES) == 0)
+        sync_hlt_exiting();
 
-    init_hypercall_page(page);
     advance_rip();
 }
 
+void xen_exit_handler::sync_hlt_exiting()
+{
+    auto pending = m_domain->physmap().scrub_pending();
+
+    if (pending == m_hlt_exiting)
+        return;
+
+    if (pending)
+        vmcs::primary_processor_based_vm_execution_controls::hlt_exiting::enable();
+    else
+        vmcs::primary_processor_based_vm_execution_controls::hlt_exiting::disable();
+
+    m_hlt_exiting = pending;
+}
+
+/*
+ * Hands on an NMI that exited but was not a kick, as soon as the guest is
+ * not blocking NMIs; NMI-window exiting brings the vCPU back when it stops.
+ * It goes ahead of any upcall, which then waits for an interrupt window.
+ */
+void xen_exit_handler::sync_nmi()
+{
+    if (m_nmi_pending && (vmcs::vm_entry_interruption_information_field::get() & VM_ENTRY_INTERRUPTION_VALID) == 0 &&
+        (vmcs::guest_interruptibility_state::get() & GUEST_INTERRUPTIBILITY_NMI_BLOCKING) == 0) {
+        vmcs::vm_entry_interruption_information_field::set(
+            VM_ENTRY_INTERRUPTION_VALID | VM_INTERRUPTION_TYPE_NMI | VM_INTERRUPTION_VECTOR_NMI);
+        m_nmi_pending = false;
+    }
+
+    if (m_nmi_pending == m_nmi_window)
+        return;
+
+    if (m_nmi_pending)
+        vmcs::primary_processor_based_vm_execution_controls::nmi_window_exiting::enable();
+    else
+        vmcs::primary_processor_based_vm_execution_controls::nmi_window_exiting::disable();
+
+    m_nmi_window = m_nmi_pending;
+}
+
+/*
+ * As Xen does for a callback vector, a pending upcall is level triggered:
+ * it is injected on every entry that finds evtchn_upcall_pending set, and
+ * the guest's handler clears it. The guest has to be taking interrupts;
+ * until it is, interrupt-window exiting brings the vCPU back here as soon
+ * as it does. A halted vCPU is woken by the injection.
+ */
+void xen_exit_handler::sync_upcall()
+{
+    auto vector = m_domain->callback_vector();
+    auto pending = false;
+
+    if (vector != 0) {
+        auto info = m_domain->vcpu_info(m_vcpuid);
+        pending = info != nullptr && __atomic_load_n(&info->evtchn_upcall_pending, __ATOMIC_SEQ_CST) != 0;
+    }
+
+    if (pending && (vmcs::vm_entry_interruption_information_field::get() & VM_ENTRY_INTERRUPTION_VALID) == 0 &&
+        (vmcs::guest_rflags::get() & RFLAGS_IF) != 0 &&
+        (vmcs::guest_interruptibility_state::get() & GUEST_INTERRUPTIBILITY_BLOCKING) == 0) {
+        vmcs::vm_entry_interruption_information_field::set(
+            VM_ENTRY_INTERRUPTION_VALID | VM_ENTRY_INTERRUPTION_EXTERNAL | vector);
+        pending = false;
+    }
+
+    if (pending == m_interrupt_window)
+        return;
+
+    if (pending)
+        vmcs::primary_processor_based_vm_execution_controls::interrupt_window_exiting::enable();
+    else
+        vmcs::primary_processor_based_vm_execution_controls::interrupt_window_exiting::disable();
+
+    m_interrupt_window = pending;
+}
+
+/*
+ * Starts the sampling period when the domain's profiler starts, and stops
+ * sampling once it stops. The period runs from one sample to the next, so
+ * other exits do not restart it.
+ */
+void xen_exit_handler::sync_oprof(uint64_t tsc)
+{
+    auto running = m_oprof != nullptr && m_domain->oprof().running();
+
+    if (running == m_oprof_armed)
+        return;
+
+    m_oprof_deadline = tsc + m_domain->oprof().period();
+    m_oprof_armed = running;
+}
+
+// The guest's CPL is taken from the RPL of its CS selector.
+void xen_exit_handler::handle_xen_oprof_sample(uint64_t tsc)
+{
+    if (!m_oprof_armed || tsc < m_oprof_deadline)
+        return;
+
+    auto user = (vmcs::guest_cs_selector::get() & 3) == 3;
+
+    m_oprof->sample(m_state_save->rip, user ? XEN_OPROF_MODE_USER : XEN_OPROF_MODE_KERNEL);
+    m_oprof_deadline = tsc + m_domain->oprof().period();
+}
+
+// Every timer that fired on this exit is reported by one VIRQ_TIMER, which
+// is injected on this entry if the guest has set a callback vector.
+void xen_exit_handler::handle_xen_timers(uint64_t tsc)
+{
+    if (m_timers.expire(tsc))
+        m_domain->evtchn().raise_virq(VIRQ_TIMER, m_vcpuid);
+}
+
+/*
+ * The VMX preemption timer is shared by the profiler, the vCPU's timers and
+ * the slice of a blocked vCPU that cannot be kicked, and is set on every
+ * entry for whichever of them is due first, counting from now. It is only
+ * disarmed, with one VMWRITE, when none is.
+ */
+void xen_exit_handler::sync_preemption_timer(uint64_t tsc)
+{
+    auto deadline = m_timers.deadline();
+
+    if (m_oprof_armed && m_oprof_deadline < deadline)
+        deadline = m_oprof_deadline;
+
+    if (m_blocked && m_block_end < deadline)
+        deadline = m_block_end;
+
+    if (deadline == ~0ULL) {
+        if (m_preemption_timer_armed) {
+            vmcs::pin_based_vm_execution_controls::activate_vmx_preemption_timer::disable();
+            m_preemption_timer_armed = false;
+        }
+
+        return;
+    }
+
+    auto ticks = deadline > tsc ? (deadline - tsc) >> m_domain->preemption_timer_rate() : 0;
+
+    vmcs::vmx_preemption_timer_value::set(ticks > 0xFFFFFFFF ? 0xFFFFFFFF : ticks);
+
+    if (!m_preemption_timer_armed) {
+        vmcs::pin_based_vm_execution_controls::activate_vmx_preemption_timer::enable();
+        m_preemption_timer_armed = true;
+    }
+}
+
+template<class P>
 void xen_exit_handler::complete_xen_vmcall(ret_type ret, vmcall_registers_t &regs)
 {
+    if (P::tracing && tracing()) {
+        uint32_t extra[] = {
+            static_cast<uint32_t>(m_state_save->rax),
+            static_cast<uint32_t>(regs.r00),
+            static_cast<uint32_t>(regs.r00 >> 32)
+        };
+
+        m_trace->record(XEN_TRC_HYPERCALL_RESULT, extra, 3);
+    }
+
     m_state_save->rax = regs.r00;
     m_state_save->rdi = regs.r01;
     m_state_save->rsi = regs.r02;
@@ -157,70 +698,262 @@ void xen_exit_handler::complete_xen_vmcall(ret_type ret, vmcall_registers_t &reg
     m_state_save->r10 = regs.r04;
     m_state_save->r08 = regs.r05;
     m_state_save->r09 = regs.r06;
+
+    // A preempted hypercall is restarted by leaving rip on the vmcall, with
+    // rax still holding the hypercall number and the arguments updated to
+    // say where to pick up.
+    if (m_continuation) {
+        m_continuation = false;
+        return;
+    }
+
     advance_rip();
 }
 
-void xen_exit_handler::init_start_info(vmcall_registers_t &regs)
+long xen_exit_handler::hypercall_continuation(vmcall_registers_t &regs)
 {
-    bfdebug << "RETRIEVED: " << std::hex << regs.r01 << bfendl;
-    auto imap = bfn::make_unique_map_x64<start_info_t>(regs.r01, vmcs::guest_cr3::get(),
-                                                       sizeof(start_info_t),
-                                                       vmcs::guest_ia32_pat::get());
-    start_info_t *start_info = imap.get();
+    m_continuation = true;
 
-    strncpy(start_info->magic, "xen-TEST-TEST", 31);
+    return static_cast<long>(regs.r00);
 }
 
-void xen_exit_handler::init_shared_info(vmcall_registers_t &regs)
+void xen_exit_handler::init_start_info(vmcall_registers_t &regs)
 {
-    auto imap = bfn::make_unique_map_x64<shared_info_t>(regs.r01, vmcs::guest_cr3::get(),
-                                                        sizeof(shared_info_t),
-                                                        vmcs::guest_ia32_pat::get());
-    shared_info = imap.get();
-    shared_info_addr = regs.r01;
-    tsc_khz = static_cast<unsigned int>(regs.r02);
-}
-
+    auto imap = map_guest<start_info_t>(regs.r01);
 
+    *imap.get() = m_domain->start_info();
+}
 
 void xen_exit_handler::set_bareflank_time(vmcall_registers_t &regs)
 {
+    auto shared_info = m_domain->shared_info();
 
-    /*
-
-    shared_info->vcpu_info[0].version = 1;
-    shared_info->wc.version = 1;
-
-    uint64_t tsc_timestamp = shared_info->vcpu_info[0].time.tsc_timestamp;
-    uint32_t seconds = shared_info->wc.sec;
-    uint32_t nanoseconds = shared_info->wc.nsec;
-    uint64_t system_time = shared_info->vcpu_info[0].time.system_time;
-    uint64_t tsc = rdtsc();
-    uint64_t new_tsc = tsc;
-
-    tsc -= tsc_timestamp;
-    system_time += NANOSECONDS(tsc);
-    nanoseconds += static_cast<uint32_t>(system_time);
-    seconds += nanoseconds / 1000000000;
-    nanoseconds = nanoseconds % 1000000000;
-
-    shared_info->vcpu_info[0].time.tsc_timestamp = new_tsc;
-    shared_info->vcpu_info[0].time.system_time = system_time;
-    shared_info->wc.sec = seconds;
-    shared_info->wc.nsec = nanoseconds;
-    */
-    auto imap = bfn::make_unique_map_x64<shared_info_t>(shared_info_addr, vmcs::guest_cr3::get(),
-                                                        sizeof(shared_info_t),
-                                                        vmcs::guest_ia32_pat::get());
-    shared_info = imap.get();
-    shared_info->vcpu_info[0].time.tsc_timestamp = regs.r01;
+    m_domain->update_time(0, regs.r01);
     shared_info->wc.sec = regs.r02;
     shared_info->wc.nsec = regs.r03;
+
+    update_stats([](auto &stats) { stats.time_updates++; });
+}
+
+// As in Xen, the timeout shares the single-shot timer with
+// VCPUOP_set_singleshot_timer, and a timeout of zero stops it.
+long xen_exit_handler::handle_set_timer_op(vmcall_registers_t &regs)
+{
+    if (regs.r01 == 0)
+        m_timers.stop_singleshot();
+    else
+        m_timers.set_singleshot(regs.r01, rdtsc());
+
+    return 0;
+}
+
+void xen_exit_handler::get_scrub_stats(vmcall_registers_t &regs)
+{
+    auto stats = m_domain->physmap().scrub_stats();
+
+    regs.r01 = stats.queued_pages;
+    regs.r02 = stats.clean_pages;
+    regs.r03 = stats.scrubbed_pages;
+    regs.r04 = stats.sync_pages;
+    regs.r05 = stats.scrub_cycles;
+
+    bfdebug << "scrub: queued " << stats.queued_pages << " clean " << stats.clean_pages
+            << " scrubbed " << stats.scrubbed_pages << " sync " << stats.sync_pages
+            << " cycles " << stats.scrub_cycles << bfendl;
+}
+
+/*
+ * Logs a summary of every vCPU's exit statistics to the debug ring. If the
+ * guest passes a buffer (r01 = gva, r02 = size in bytes), the raw
+ * xen_exit_stats_data of as many vCPUs as fit is copied to it as well, in
+ * vCPU order. Returns the number of vCPUs copied in r01.
+ */
+void xen_exit_handler::dump_exit_stats(vmcall_registers_t &regs)
+{
+    auto count = regs.r02 / sizeof(xen_exit_stats_data);
+    auto copied = 0UL;
+
+    for (auto vcpuid = 0UL; vcpuid < XEN_MAX_VCPUS; vcpuid++) {
+        auto stats = m_domain->exit_stats(vcpuid);
+        auto data = stats != nullptr ? stats->data() : nullptr;
+
+        if (data == nullptr)
+            continue;
+
+        for (auto i = 0; i < XEN_EXIT_STATS_REASONS; i++) {
+            auto &&hist = data->reasons[i];
+
+            if (hist.count != 0)
+                bfdebug << "vcpu " << vcpuid << " exit " << i << ": count " << hist.count
+                        << " avg " << hist.total_cycles / hist.count
+                        << " max " << hist.max_cycles << bfendl;
+        }
+
+        for (auto i = 0; i < XEN_EXIT_STATS_HYPERCALLS; i++) {
+            auto &&hist = data->hypercalls[i];
+
+            if (hist.count != 0)
+                bfdebug << "vcpu " << vcpuid << " hypercall " << i << ": count " << hist.count
+                        << " avg " << hist.total_cycles / hist.count
+                        << " max " << hist.max_cycles << bfendl;
+        }
+
+        if (regs.r01 != 0 && copied < count) {
+            auto imap = map_guest<xen_exit_stats_data>(regs.r01 + copied * sizeof(*data));
+
+            *imap.get() = *data;
+            copied++;
+        }
+    }
+
+    regs.r01 = copied;
+}
+
+/*
+ * Dumps one vCPU's exit sites (r01 = vcpuid), most expensive first, to the
+ * debug ring and, given a buffer (r02 = gva, r03 = size), to the guest. The
+ * number of sites copied is returned in r01 and the number of exits that
+ * found the table full in r02. Addresses are left for the guest to resolve.
+ *
+ * The sites are sorted straight from the table into a small array on the
+ * stack and into the guest's buffer, so nothing is allocated.
+ */
+void xen_exit_handler::dump_exit_sites(vmcall_registers_t &regs)
+{
+    auto stats = m_domain->exit_stats(regs.r01);
+    auto table = stats != nullptr ? stats->sites() : nullptr;
+
+    if (table == nullptr) {
+        regs.r01 = static_cast<uintptr_t>(-XEN_ENOENT);
+        return;
+    }
+
+    auto first = std::begin(table->sites);
+    auto last = std::end(table->sites);
+    auto used = static_cast<uint64_t>(std::count_if(first, last, [](const auto &site)
+    { return site.count != 0; }));
+
+    // Unused entries sort last.
+    auto costlier = [](const auto &a, const auto &b) {
+        if ((a.count != 0) != (b.count != 0))
+            return a.count != 0;
+
+        return a.total_cycles > b.total_cycles;
+    };
+
+    xen_exit_site top[XEN_EXIT_SITES_DUMP];
+    auto logged = std::partial_sort_copy(first, last, top, top + std::min(used, XEN_EXIT_SITES_DUMP),
+                                         costlier);
+
+    for (auto site = top; site != logged; site++) {
+        bfdebug << "vcpu " << regs.r01 << " rip 0x" << std::hex << site->rip << std::dec
+                << " exit " << site->reason
+                << " hypercall " << static_cast<int32_t>(site->hypercall)
+                << ": count " << site->count << " cycles " << site->total_cycles
+                << bfendl;
+    }
+
+    auto count = regs.r02 != 0 ? std::min(used, regs.r03 / sizeof(xen_exit_site)) : 0;
+
+    if (count != 0) {
+        auto imap = map_guest<xen_exit_site>(regs.r02, count * sizeof(xen_exit_site));
+        std::partial_sort_copy(first, last, imap.get(), imap.get() + count, costlier);
+    }
+
+    regs.r01 = count;
+    regs.r02 = table->dropped;
+}
+
+void xen_exit_handler::get_stats_page(vmcall_registers_t &regs)
+{
+    regs.r01 = m_domain->stats_page_maddr();
+}
+
+/*
+ * The private equivalent of XEN_SYSCTL_tbuf_op. GET_INFO returns the t_info
+ * page's machine address in r01, its size in pages in r02 and the size of
+ * each trace buffer in pages in r03.
+ */
+void xen_exit_handler::trace_op(vmcall_registers_t &regs)
+{
+    auto &&tbuf = m_domain->tbuf();
+
+    switch (regs.r01) {
+    case TRACE_OP_GET_INFO:
+        regs.r01 = tbuf.t_info_maddr();
+        regs.r02 = 1;
+        regs.r03 = XEN_TBUF_PAGES;
+        break;
+
+    case TRACE_OP_ENABLE:
+        tbuf.enable(true);
+        break;
+
+    case TRACE_OP_DISABLE:
+        tbuf.enable(false);
+        break;
+
+    default:
+        regs.r01 = static_cast<uintptr_t>(-XEN_EINVAL);
+        break;
+    }
+}
+
+void xen_exit_handler::flush_log()
+{
+    if (!m_log.empty())
+        m_log.flush(m_vcpuid);
+}
+
+/*
+ * Starts or stops capturing the exits of all vCPUs, or copies out part of
+ * one vCPU's capture log: r02 = vcpuid, r03 = offset, r04 = gva, r05 = size.
+ * READ returns the number of bytes copied in r01 (0 at the end of the log),
+ * and can only be used while capture is stopped.
+ */
+void xen_exit_handler::capture_op(vmcall_registers_t &regs)
+{
+    auto &&generation = m_domain->capture_generation();
+    auto current = generation.load();
+
+    switch (regs.r01) {
+    case CAPTURE_OP_START:
+        if ((current & 1) == 0)
+            generation.compare_exchange_strong(current, current + 1);
+        break;
+
+    case CAPTURE_OP_STOP:
+        if ((current & 1) != 0)
+            generation.compare_exchange_strong(current, current + 1);
+        break;
+
+    case CAPTURE_OP_READ: {
+        auto capture = m_domain->capture(regs.r02);
+
+        if ((current & 1) != 0) {
+            regs.r01 = static_cast<uintptr_t>(-XEN_EBUSY);
+            break;
+        }
+
+        if (capture == nullptr) {
+            regs.r01 = static_cast<uintptr_t>(-XEN_ENOENT);
+            break;
+        }
+
+        auto imap = map_guest<uint8_t>(regs.r04, regs.r05);
+        regs.r01 = capture->read(regs.r03, imap.get(), regs.r05);
+        break;
+    }
+
+    default:
+        regs.r01 = static_cast<uintptr_t>(-XEN_EINVAL);
+        break;
+    }
 }
 
 void xen_exit_handler::handle_vmcall_console_io(uintptr_t rdi, uintptr_t rsi, uintptr_t rdx)
 {
-    bfdebug << "console io" << bfendl;
+    xen_log_debug(xen_log_console_io, rdi);
 
     switch(rdi) {
     case xen_hypercall::console_io_cmd::write:
@@ -235,18 +968,61 @@ void xen_exit_handler::handle_vmcall_console_io(uintptr_t rdi, uintptr_t rsi, ui
 
 void xen_exit_handler::handle_console_io_write(uintptr_t rsi, uintptr_t rdx)
 {
+    auto imap = map_guest<char>(rdx, rsi);
 
-    auto imap = bfn::make_unique_map_x64<char>(rdx, vmcs::guest_cr3::get(), rsi,
-                                               vmcs::guest_ia32_pat::get());
-    bfdebug << std::string(imap.get(), rsi) << bfendl;
+    // Written straight from the guest's buffer: a std::string copy would
+    // allocate on the VMM heap for anything but the shortest lines.
+    (bfdebug).write(imap.get(), static_cast<std::streamsize>(rsi)) << bfendl;
 }
 
 void xen_exit_handler::handle_console_io_read()
 {
-    bfdebug << "Do console io: read" << bfendl;
+    xen_log_warn(xen_log_console_read);
 }
 
 void xen_exit_handler::handle_test_vmcall()
 {
-    bfdebug << "You made it!" << bfendl;
+    xen_log_info(xen_log_test_vmcall);
+}
+
+template<bool Pvclock, bool EventChannels, bool Tracing>
+static std::unique_ptr<xen_exit_handler>
+make_with_console(vcpuid::type vcpuid, xen_domain *domain, const xen_features &features)
+{
+    if (features.console == xen_console_mode::discard) {
+        using policy = xen_policy<Pvclock, EventChannels, Tracing, xen_console_mode::discard>;
+        return std::make_unique<xen_exit_handler_t<policy>>(vcpuid, domain);
+    }
+
+    using policy = xen_policy<Pvclock, EventChannels, Tracing, xen_console_mode::debug_ring>;
+    return std::make_unique<xen_exit_handler_t<policy>>(vcpuid, domain);
+}
+
+template<bool Pvclock, bool EventChannels>
+static std::unique_ptr<xen_exit_handler>
+make_with_tracing(vcpuid::type vcpuid, xen_domain *domain, const xen_features &features)
+{
+    if (features.tracing)
+        return make_with_console<Pvclock, EventChannels, true>(vcpuid, domain, features);
+
+    return make_with_console<Pvclock, EventChannels, false>(vcpuid, domain, features);
+}
+
+template<bool Pvclock>
+static std::unique_ptr<xen_exit_handler>
+make_with_event_channels(vcpuid::type vcpuid, xen_domain *domain, const xen_features &features)
+{
+    if (features.event_channels)
+        return make_with_tracing<Pvclock, true>(vcpuid, domain, features);
+
+    return make_with_tracing<Pvclock, false>(vcpuid, domain, features);
+}
+
+std::unique_ptr<xen_exit_handler>
+make_xen_exit_handler(vcpuid::type vcpuid, xen_domain *domain, const xen_features &features)
+{
+    if (features.pvclock)
+        return make_with_event_channels<true>(vcpuid, domain, features);
+
+    return make_with_event_channels<false>(vcpuid, domain, features);
 }
@@ -0,0 +1,33 @@
+#include <exit_handler/xen_exit_handler.h>
+#include <exit_handler/xen_domain.h>
+#include <xen.h>
+#include <xen_errno.h>
+#include <xen_hvm_op.h>
+#include <xen_hypercalls.h>
+
+/*
+ * Of the HVM parameters only HVM_PARAM_CALLBACK_IRQ is kept, which is how
+ * the guest asks for its event channel upcalls to be injected as an
+ * interrupt (see sync_upcall).
+ */
+long xen_exit_handler::handle_hvm_op(vmcall_registers_t &regs)
+{
+    if (regs.r01 != HVMOP_set_param && regs.r01 != HVMOP_get_param)
+        return -XEN_ENOSYS;
+
+    auto imap = map_guest<xen_hvm_param>(regs.r02);
+    auto param = imap.get();
+
+    if (param->domid != DOMID_SELF)
+        return -XEN_ESRCH;
+
+    if (param->index != HVM_PARAM_CALLBACK_IRQ)
+        return -XEN_EINVAL;
+
+    if (regs.r01 == HVMOP_get_param) {
+        param->value = m_domain->callback_irq();
+        return 0;
+    }
+
+    return m_domain->set_callback_irq(param->value);
+}
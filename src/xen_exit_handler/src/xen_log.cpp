@@ -0,0 +1,44 @@
+#include <exit_handler/xen_log.h>
+#include <debug.h>
+
+static const char *g_formats[xen_log_num_formats] = {
+    "cpuid: Xen leaves",
+    "wrmsr: hypercall page at gpa %x",
+    "console_io: cmd %d",
+    "console_io: read is not supported",
+    "test vmcall",
+    "sched_op: shutdown, reason %d",
+};
+
+static const char *g_levels[] = { "", "error", "warn", "info", "debug" };
+
+void xen_log_ring::flush(uint64_t vcpuid)
+{
+    for (; m_tail != m_head; m_tail++) {
+        auto &&entry = m_entries[m_tail % XEN_LOG_RING_ENTRIES];
+        auto arg = 0U;
+
+        bfdebug << "[vcpu " << std::dec << vcpuid << " " << g_levels[entry.level] << " "
+                << entry.tsc << "] ";
+
+        for (auto p = g_formats[entry.fmt]; *p != '\0'; p++) {
+            if (p[0] == '%' && (p[1] == 'x' || p[1] == 'd') && arg < entry.nr_args) {
+                if (*++p == 'x')
+                    bfdebug << "0x" << std::hex << entry.args[arg++] << std::dec;
+                else
+                    bfdebug << entry.args[arg++];
+            }
+            else {
+                bfdebug << *p;
+            }
+        }
+
+        bfdebug << bfendl;
+    }
+
+    if (m_dropped != 0) {
+        bfdebug << "[vcpu " << std::dec << vcpuid << "] " << m_dropped
+                << " log message(s) dropped" << bfendl;
+        m_dropped = 0;
+    }
+}
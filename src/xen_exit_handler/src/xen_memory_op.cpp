@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <exit_handler/xen_exit_handler.h>
+#include <exit_handler/xen_domain.h>
+#include <xen.h>
+#include <xen_errno.h>
+#include <xen_hypercalls.h>
+#include <xen_memory.h>
+
+long xen_exit_handler::handle_memory_op(vmcall_registers_t &regs)
+{
+    switch (regs.r01 & MEMOP_CMD_MASK) {
+    case xen_hypercall::memory_op_cmd::add_to_physmap:
+        return memory_op_add_to_physmap(regs.r02);
+
+    case xen_hypercall::memory_op_cmd::remove_from_physmap:
+        return memory_op_remove_from_physmap(regs.r02);
+
+    case xen_hypercall::memory_op_cmd::increase_reservation:
+    case xen_hypercall::memory_op_cmd::decrease_reservation:
+    case xen_hypercall::memory_op_cmd::populate_physmap:
+        return memory_op_reservation(regs);
+
+    default:
+        return -XEN_ENOSYS;
+    }
+}
+
+long xen_exit_handler::memory_op_add_to_physmap(uintptr_t arg)
+{
+    auto imap = map_guest<xen_add_to_physmap>(arg);
+    auto xatp = imap.get();
+
+    if (xatp->domid != DOMID_SELF)
+        return -XEN_ESRCH;
+
+    return m_domain->add_to_physmap(xatp->space, xatp->idx, xatp->gpfn);
+}
+
+long xen_exit_handler::memory_op_remove_from_physmap(uintptr_t arg)
+{
+    auto imap = map_guest<xen_remove_from_physmap>(arg);
+    auto xrfp = imap.get();
+
+    if (xrfp->domid != DOMID_SELF)
+        return -XEN_ESRCH;
+
+    return m_domain->remove_from_physmap(xrfp->gpfn);
+}
+
+/*
+ * The extent list is walked one page of pfns at a time, and each page is
+ * handed to the physmap as a single batch, with a budget of
+ * XEN_MEMOP_PAGES_PER_EXIT for the extents and the frames zeroed on the way
+ * (see xen_physmap.h). Once it is spent the hypercall is preempted: the
+ * extent to resume from is encoded in the upper bits of the command, as Xen
+ * does, and the guest re-executes the vmcall. A 1G extent with dirty frames
+ * takes several exits. The final return value is the number of extents
+ * completed.
+ */
+long xen_exit_handler::memory_op_reservation(vmcall_registers_t &regs)
+{
+    auto op = regs.r01 & MEMOP_CMD_MASK;
+    auto start = regs.r01 >> MEMOP_EXTENT_SHIFT;
+
+    auto imap = map_guest<xen_memory_reservation>(regs.r02);
+    auto reservation = *imap.get();
+
+    if (reservation.domid != DOMID_SELF)
+        return -XEN_ESRCH;
+
+    if (reservation.extent_order > XEN_MAX_EXTENT_ORDER)
+        return -XEN_EINVAL;
+
+    if (reservation.nr_extents > (~0UL >> MEMOP_EXTENT_SHIFT) || start > reservation.nr_extents)
+        return -XEN_EINVAL;
+
+    auto &&physmap = m_domain->physmap();
+    auto extent_start = reinterpret_cast<uintptr_t>(reservation.extent_start);
+    auto budget = XEN_MEMOP_PAGES_PER_EXIT;
+
+    while (start < reservation.nr_extents) {
+        auto count = std::min(reservation.nr_extents - start, XEN_MEMOP_CHUNK);
+        auto emap = map_guest<xen_pfn_t>(extent_start + start * sizeof(xen_pfn_t),
+                                         count * sizeof(xen_pfn_t));
+        auto done = 0UL;
+
+        switch (op) {
+        case xen_hypercall::memory_op_cmd::increase_reservation:
+            done = physmap.reclaim(emap.get(), count, reservation.extent_order, budget);
+            break;
+
+        case xen_hypercall::memory_op_cmd::decrease_reservation:
+            done = physmap.release(emap.get(), count, reservation.extent_order, budget);
+            break;
+
+        case xen_hypercall::memory_op_cmd::populate_physmap:
+            done = physmap.populate(emap.get(), count, reservation.extent_order, budget);
+            break;
+        }
+
+        start += done;
+
+        if (budget == 0)
+            break;
+
+        if (done != count)
+            return static_cast<long>(start);
+    }
+
+    if (start < reservation.nr_extents) {
+        regs.r01 = op | (start << MEMOP_EXTENT_SHIFT);
+        return hypercall_continuation(regs);
+    }
+
+    return static_cast<long>(start);
+}
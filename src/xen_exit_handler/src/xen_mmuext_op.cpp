@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <exit_handler/xen_exit_handler.h>
+#include <exit_handler/xen_domain.h>
+#include <exit_handler/xen_page_ops.h>
+#include <xen.h>
+#include <xen_errno.h>
+
+// Set in the count of a preempted mmuext_op, as Xen does, so that the
+// continuation adds to *pdone instead of overwriting it.
+#define MMU_UPDATE_PREEMPTED (~(~0U >> 1))
+
+long xen_exit_handler::handle_mmuext_op(vmcall_registers_t &regs)
+{
+    auto uops = regs.r01;
+    auto count = static_cast<unsigned int>(regs.r02);
+    auto pdone = regs.r03;
+    auto foreigndom = static_cast<domid_t>(regs.r04);
+    auto done = 0U;
+
+    if (foreigndom != DOMID_SELF && foreigndom != 0)
+        return -XEN_ESRCH;
+
+    if ((count & MMU_UPDATE_PREEMPTED) != 0) {
+        count &= ~MMU_UPDATE_PREEMPTED;
+
+        if (pdone != 0)
+            done = *map_guest<unsigned int>(pdone).get();
+    }
+
+    if (count == 0)
+        return 0;
+
+    auto batch = std::min(count, XEN_MMUEXT_OPS_PER_EXIT);
+    auto imap = map_guest<mmuext_op>(uops, batch * sizeof(mmuext_op));
+    auto ops = imap.get();
+
+    auto rc = 0L;
+    auto i = 0U;
+
+    for (; i < batch; i++) {
+        if ((rc = do_mmuext_op(ops[i])) != 0)
+            break;
+    }
+
+    if (pdone != 0)
+        *map_guest<unsigned int>(pdone).get() = done + i;
+
+    if (rc != 0)
+        return rc;
+
+    if (i < count) {
+        regs.r01 = uops + i * sizeof(mmuext_op);
+        regs.r02 = (count - i) | MMU_UPDATE_PREEMPTED;
+        return hypercall_continuation(regs);
+    }
+
+    return 0;
+}
+
+long xen_exit_handler::do_mmuext_op(const mmuext_op &op)
+{
+    auto &&physmap = m_domain->physmap();
+
+    switch (op.cmd) {
+    case MMUEXT_CLEAR_PAGE: {
+        if (!physmap.is_populated(op.arg1.mfn))
+            return -XEN_EINVAL;
+
+        auto &&dst = bfn::make_unique_map_x64<uint8_t>(op.arg1.mfn << 12);
+        clear_page(dst.get());
+
+        return 0;
+    }
+
+    case MMUEXT_COPY_PAGE: {
+        if (!physmap.is_populated(op.arg1.mfn) || !physmap.is_populated(op.arg2.src_mfn))
+            return -XEN_EINVAL;
+
+        auto &&dst = bfn::make_unique_map_x64<uint8_t>(op.arg1.mfn << 12);
+        auto &&src = bfn::make_unique_map_x64<uint8_t>(op.arg2.src_mfn << 12);
+        copy_page(dst.get(), src.get());
+
+        return 0;
+    }
+
+    default:
+        return -XEN_ENOSYS;
+    }
+}
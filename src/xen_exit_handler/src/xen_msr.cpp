@@ -0,0 +1,49 @@
+#include <exit_handler/xen_msr.h>
+#include <exit_handler/xen_exit_handler.h>
+#include <memory_manager/memory_manager_x64.h>
+
+#define MSR_IA32_TSC_DEADLINE 0x000006E0U
+#define MSR_X2APIC_FIRST 0x00000800U
+#define MSR_X2APIC_LAST 0x000008FFU
+#define MSR_FS_BASE 0xC0000100U
+#define MSR_GS_BASE 0xC0000101U
+#define MSR_KERNEL_GS_BASE 0xC0000102U
+
+xen_msr_bitmap::xen_msr_bitmap()
+{
+    m_page = std::make_unique<uint8_t[]>(PAGE_SIZE);
+    memset(m_page.get(), 0xFF, PAGE_SIZE);
+
+    m_maddr = g_mm->virtptr_to_physint(m_page.get());
+
+    pass_through(MSR_IA32_TSC_DEADLINE);
+
+    for (auto msr = MSR_X2APIC_FIRST; msr <= MSR_X2APIC_LAST; msr++)
+        pass_through(msr);
+
+    pass_through(MSR_FS_BASE);
+    pass_through(MSR_GS_BASE);
+    pass_through(MSR_KERNEL_GS_BASE);
+
+    trap_write(MSR_IA32_XSS);
+}
+
+// Each half of the page (reads, then writes) holds the low range's bits
+// and then the high range's.
+void xen_msr_bitmap::set(uint32_t msr, uint32_t offset, bool trap)
+{
+    if (msr >= 0xC0000000 && msr <= 0xC0001FFF) {
+        offset += 1024;
+        msr -= 0xC0000000;
+    }
+    else if (msr > 0x1FFF) {
+        return;
+    }
+
+    auto bit = static_cast<uint8_t>(1U << (msr % 8));
+
+    if (trap)
+        m_page[offset + msr / 8] |= bit;
+    else
+        m_page[offset + msr / 8] &= static_cast<uint8_t>(~bit);
+}
@@ -0,0 +1,106 @@
+#include <exit_handler/xen_oprof.h>
+#include <exit_handler/xen_evtchn.h>
+#include <exit_handler/xen_errno.h>
+#include <exit_handler/xen_exit_handler.h>
+#include <memory_manager/memory_manager_x64.h>
+
+#define IA32_VMX_MISC 0x485
+
+uint64_t vmx_preemption_timer_rate(void)
+{
+    uint32_t low, high;
+
+    asm volatile ("rdmsr"
+                  : "=a" (low), "=d" (high)
+                  : "c" (IA32_VMX_MISC));
+    return low & 0x1F;
+}
+
+xen_oprof_ring::xen_oprof_ring(uint64_t vcpuid, const std::atomic<bool> &virq, xen_evtchn &evtchn) :
+    m_vcpuid(vcpuid),
+    m_virq(virq),
+    m_evtchn(evtchn),
+    m_signalled(false)
+{
+    m_page = std::make_unique<uint8_t[]>(PAGE_SIZE);
+    memset(m_page.get(), 0, PAGE_SIZE);
+
+    m_buf = reinterpret_cast<xenoprof_buf *>(m_page.get());
+    m_buf->event_size = static_cast<uint32_t>((PAGE_SIZE - sizeof(xenoprof_buf)) / sizeof(event_log) + 1);
+    m_buf->vcpu_id = static_cast<uint32_t>(vcpuid);
+    m_maddr = g_mm->virtptr_to_physint(m_page.get());
+}
+
+void xen_oprof_ring::sample(uint64_t rip, uint8_t mode)
+{
+    auto head = m_buf->event_head;
+    auto tail = __atomic_load_n(&m_buf->event_tail, __ATOMIC_ACQUIRE);
+    auto size = m_buf->event_size;
+    auto next = head + 1 < size ? head + 1 : 0;
+
+    if (next == tail) {
+        m_buf->lost_samples++;
+        return;
+    }
+
+    m_buf->event_log[head].eip = rip;
+    m_buf->event_log[head].mode = mode;
+    m_buf->event_log[head].event = 0;
+
+    if (mode == XEN_OPROF_MODE_USER)
+        m_buf->user_samples++;
+    else
+        m_buf->kernel_samples++;
+
+    __atomic_store_n(&m_buf->event_head, next, __ATOMIC_RELEASE);
+
+    // Signal the consumer once per crossing of the half-full mark.
+    auto unconsumed = next >= tail ? next - tail : next + size - tail;
+
+    if (unconsumed >= size / 2) {
+        if (!m_signalled && m_virq.load(std::memory_order_relaxed))
+            m_signalled = m_evtchn.raise_virq(VIRQ_XENOPROF, m_vcpuid);
+    }
+    else {
+        m_signalled = false;
+    }
+}
+
+xen_oprof::xen_oprof(xen_evtchn &evtchn) :
+    m_evtchn(evtchn),
+    m_running(false),
+    m_virq(false),
+    m_period(XEN_OPROF_DEFAULT_PERIOD)
+{ }
+
+xen_oprof_ring *xen_oprof::ring(uint64_t vcpuid)
+{
+    if (vcpuid >= XEN_MAX_VCPUS)
+        return nullptr;
+
+    if (!m_rings[vcpuid])
+        m_rings[vcpuid] = std::make_unique<xen_oprof_ring>(vcpuid, m_virq, m_evtchn);
+
+    return m_rings[vcpuid].get();
+}
+
+long xen_oprof::set_period(uint64_t period)
+{
+    if (running())
+        return -XEN_EBUSY;
+
+    if (period < XEN_OPROF_MIN_PERIOD)
+        return -XEN_EINVAL;
+
+    m_period = period;
+    return 0;
+}
+
+long xen_oprof::start()
+{
+    if (running())
+        return -XEN_EBUSY;
+
+    m_running = true;
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <exit_handler/xen_physmap.h>
+#include <exit_handler/xen_exit_handler.h>
+#include <exit_handler/xen_page_ops.h>
+
+xen_physmap::xen_physmap(unsigned long tot_pages, unsigned long max_pages) :
+    m_scrub_pending(false),
+    m_tot_pages(tot_pages),
+    m_max_pages(max_pages),
+    m_scrubbed_pages(0),
+    m_sync_pages(0),
+    m_scrub_cycles(0)
+{ }
+
+unsigned long xen_physmap::populate(xen_pfn_t *extents, unsigned long count, unsigned int order,
+                                   unsigned long &budget)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto nr = 1UL << order;
+    auto i = 0UL;
+
+    for (; i < count && budget != 0; i++) {
+        auto gpfn = extents[i];
+
+        if ((gpfn & (nr - 1)) != 0)
+            break;
+
+        if (m_max_pages != 0 && m_tot_pages + released(gpfn, gpfn + nr) > m_max_pages)
+            break;
+
+        if (!fits(gpfn, gpfn + nr, budget))
+            break;
+
+        m_tot_pages += take(gpfn, gpfn + nr);
+    }
+
+    m_scrub_pending = !m_dirty.empty();
+    return i;
+}
+
+unsigned long xen_physmap::release(xen_pfn_t *extents, unsigned long count, unsigned int order,
+                                  unsigned long &budget)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto nr = 1UL << order;
+    auto i = 0UL;
+
+    for (; i < count && budget != 0; i++, budget--) {
+        auto gpfn = extents[i];
+
+        if ((gpfn & (nr - 1)) != 0)
+            break;
+
+        // Clamped, as the domain may not have been told how many pages
+        // it started with.
+        auto populated = nr - released(gpfn, gpfn + nr);
+        m_tot_pages -= populated < m_tot_pages ? populated : m_tot_pages;
+
+        m_clean.remove(gpfn, gpfn + nr);
+        m_dirty.insert(gpfn, gpfn + nr);
+    }
+
+    m_scrub_pending = !m_dirty.empty();
+    return i;
+}
+
+unsigned long xen_physmap::reclaim(xen_pfn_t *extents, unsigned long count, unsigned int order,
+                                  unsigned long &budget)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto nr = 1UL << order;
+    auto i = 0UL;
+
+    for (; i < count && budget != 0; i++) {
+        xen_pfn_t gpfn;
+
+        if (m_max_pages != 0 && m_tot_pages + nr > m_max_pages)
+            break;
+
+        if (!m_clean.find_aligned(order, gpfn) && !find_released(order, gpfn))
+            break;
+
+        if (!fits(gpfn, gpfn + nr, budget))
+            break;
+
+        m_tot_pages += take(gpfn, gpfn + nr);
+        extents[i] = gpfn;
+    }
+
+    m_scrub_pending = !m_dirty.empty();
+    return i;
+}
+
+/*
+ * Zeroes up to budget dirty frames and moves them to the clean pool. This
+ * is called from idle vCPUs, and runs under the lock so that a frame can
+ * never be handed back to the guest while it is being scrubbed.
+ */
+unsigned long xen_physmap::scrub(unsigned long budget)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto done = 0UL;
+    auto start_tsc = rdtsc();
+
+    while (done < budget) {
+        xen_pfn_t start, end;
+
+        if (!m_dirty.pop(budget - done, start, end))
+            break;
+
+        zero_frames(start, end);
+        m_clean.insert(start, end);
+
+        done += end - start;
+    }
+
+    m_scrubbed_pages += done;
+    m_scrub_cycles += rdtsc() - start_tsc;
+
+    m_scrub_pending = !m_dirty.empty();
+    return done;
+}
+
+bool xen_physmap::is_populated(xen_pfn_t gpfn)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return released(gpfn, gpfn + 1) == 0;
+}
+
+xen_scrub_stats xen_physmap::scrub_stats()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    return { m_dirty.pages(), m_clean.pages(), m_scrubbed_pages, m_sync_pages, m_scrub_cycles };
+}
+
+unsigned long xen_physmap::released(xen_pfn_t start, xen_pfn_t end) const
+{
+    return m_dirty.count(start, end) + m_clean.count(start, end);
+}
+
+/*
+ * Finds a naturally aligned block of 2^order released frames, which may be
+ * partly clean and partly dirty once the scrubber or an earlier call has
+ * been at it. The two sets never overlap, so they are walked together in
+ * order as runs of released frames.
+ */
+bool xen_physmap::find_released(unsigned int order, xen_pfn_t &gpfn) const
+{
+    auto nr = 1UL << order;
+    auto clean = m_clean.begin();
+    auto dirty = m_dirty.begin();
+    xen_pfn_t run_start = 0;
+    xen_pfn_t run_end = 0;
+
+    while (clean != m_clean.end() || dirty != m_dirty.end()) {
+        auto from_clean = dirty == m_dirty.end() ||
+                          (clean != m_clean.end() && clean->first < dirty->first);
+        auto range = from_clean ? *clean++ : *dirty++;
+
+        if (range.first > run_end)
+            run_start = range.first;
+
+        run_end = std::max(run_end, range.second);
+
+        auto aligned = (run_start + nr - 1) & ~(nr - 1);
+
+        if (aligned + nr <= run_end) {
+            gpfn = aligned;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Takes the extent's share of the budget: one, and one for each dirty frame
+ * take() would have to zero. If that is more than is left, the rest of the
+ * budget is spent zeroing them now instead, and the extent is left for the
+ * next call.
+ */
+bool xen_physmap::fits(xen_pfn_t start, xen_pfn_t end, unsigned long &budget)
+{
+    auto cost = m_dirty.count(start, end) + 1;
+
+    if (cost <= budget) {
+        budget -= cost;
+        return true;
+    }
+
+    xen_pfn_t a, b;
+
+    while (budget != 0 && m_dirty.first_in(start, end, a, b)) {
+        b = std::min(b, a + budget);
+
+        m_dirty.remove(a, b);
+        zero_frames(a, b);
+        m_clean.insert(a, b);
+
+        m_sync_pages += b - a;
+        budget -= b - a;
+    }
+
+    budget = 0;
+    return false;
+}
+
+// Hands [start, end) back to the guest, zeroing whatever the scrubber has
+// not reached yet. Returns how many frames were released before.
+unsigned long xen_physmap::take(xen_pfn_t start, xen_pfn_t end)
+{
+    auto pages = m_clean.remove(start, end);
+
+    pages += m_dirty.remove(start, end, [&](xen_pfn_t a, xen_pfn_t b) {
+        zero_frames(a, b);
+        m_sync_pages += b - a;
+    });
+
+    return pages;
+}
+
+void xen_physmap::zero_frames(xen_pfn_t start, xen_pfn_t end)
+{
+    for (auto gpfn = start; gpfn < end; gpfn++) {
+        auto &&map = bfn::make_unique_map_x64<uint8_t>(gpfn << 12);
+        clear_page_nt(map.get());
+    }
+}
@@ -0,0 +1,80 @@
+#include <exit_handler/xen_runstate.h>
+
+xen_runstate::xen_runstate(const xen_tsc_clock &clock, const std::atomic<bool> &update_flag) :
+    m_clock(clock),
+    m_update_flag(update_flag),
+    m_seq(0),
+    m_state(RUNSTATE_offline),
+    m_entry_tsc(0),
+    m_cycles(),
+    m_pending(false)
+{ }
+
+vcpu_runstate_info xen_runstate::info() const
+{
+    vcpu_runstate_info info = {};
+    uint64_t seq;
+    int state;
+    uint64_t entry_tsc;
+    uint64_t cycles[4];
+
+    do {
+        seq = __atomic_load_n(&m_seq, __ATOMIC_ACQUIRE);
+
+        state = m_state;
+        entry_tsc = m_entry_tsc;
+
+        for (auto i = 0; i < 4; i++)
+            cycles[i] = m_cycles[i];
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    while ((seq & 1) != 0 || seq != __atomic_load_n(&m_seq, __ATOMIC_RELAXED));
+
+    info.state = state;
+    info.state_entry_time = m_clock.ns(entry_tsc);
+
+    for (auto i = 0; i < 4; i++)
+        info.time[i] = m_clock.ns(cycles[i]);
+
+    return info;
+}
+
+// An area registered but not yet taken up was never written, so it can be
+// replaced here.
+void xen_runstate::register_area(bfn::unique_map_ptr_x64<vcpu_runstate_info> &&map)
+{
+    std::lock_guard<std::mutex> guard(m_pending_mutex);
+
+    m_pending_map = std::move(map);
+    m_pending.store(true, std::memory_order_release);
+}
+
+void xen_runstate::take_area()
+{
+    std::lock_guard<std::mutex> guard(m_pending_mutex);
+
+    m_area_map = std::move(m_pending_map);
+    m_pending.store(false, std::memory_order_relaxed);
+}
+
+void xen_runstate::publish()
+{
+    auto area = m_area_map.get();
+    auto current = info();
+    auto flag = m_update_flag.load(std::memory_order_relaxed);
+
+    if (flag) {
+        area->state_entry_time = current.state_entry_time | XEN_RUNSTATE_UPDATE;
+        std::atomic_signal_fence(std::memory_order_release);
+    }
+
+    area->state = current.state;
+    area->time[0] = current.time[0];
+    area->time[1] = current.time[1];
+    area->time[2] = current.time[2];
+    area->time[3] = current.time[3];
+    std::atomic_signal_fence(std::memory_order_release);
+
+    area->state_entry_time = current.state_entry_time;
+}
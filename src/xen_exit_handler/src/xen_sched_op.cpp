@@ -0,0 +1,143 @@
+#include <exit_handler/xen_exit_handler.h>
+#include <exit_handler/xen_domain.h>
+#include <xen.h>
+#include <xen_errno.h>
+#include <xen_hypercalls.h>
+#include <xen_sched.h>
+
+using namespace intel_x64;
+
+#define IA32_APIC_BASE 0x1B
+#define IA32_APIC_BASE_EXTD (1ULL << 10)
+#define IA32_X2APIC_ICR 0x830
+#define APIC_ICR_DELIVERY_NMI (4ULL << 8)
+#define APIC_ICR_LEVEL_ASSERT (1ULL << 14)
+
+bool x2apic_enabled(void)
+{
+    uint32_t low, high;
+
+    asm volatile ("rdmsr"
+                  : "=a" (low), "=d" (high)
+                  : "c" (IA32_APIC_BASE));
+    return (low & IA32_APIC_BASE_EXTD) != 0;
+}
+
+// The x2APIC ID of the calling CPU, from the topology leaf.
+uint32_t x2apic_id(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    asm volatile ("cpuid"
+                  : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                  : "a" (0xB), "c" (0));
+    return edx;
+}
+
+void x2apic_send_nmi(uint32_t apic_id)
+{
+    auto icr = static_cast<uint64_t>(apic_id) << 32 | APIC_ICR_DELIVERY_NMI | APIC_ICR_LEVEL_ASSERT;
+
+    asm volatile ("wrmsr"
+                  :
+                  : "c" (IA32_X2APIC_ICR), "a" (static_cast<uint32_t>(icr)),
+                    "d" (static_cast<uint32_t>(icr >> 32))
+                  : "memory");
+}
+
+/*
+ * Each vCPU has a physical CPU to itself, so there is never anything to
+ * yield to. Shutdown is recorded in the domain (see xen_domain::shutdown)
+ * and returns.
+ */
+long xen_exit_handler::handle_sched_op(vmcall_registers_t &regs)
+{
+    switch (regs.r01) {
+    case SCHEDOP_yield:
+        return 0;
+
+    case SCHEDOP_block:
+        block();
+        return 0;
+
+    case SCHEDOP_shutdown: {
+        auto imap = map_guest<sched_shutdown>(regs.r02);
+        auto reason = imap.get()->reason;
+
+        xen_log_info(xen_log_shutdown, reason);
+        return m_domain->shutdown(reason);
+    }
+
+    default:
+        return -XEN_ENOSYS;
+    }
+}
+
+/*
+ * As in Xen, blocking enables event delivery, and the vCPU does not block
+ * if an event is already pending. Otherwise the hypercall returns with the
+ * guest in the HLT activity state, so the CPU idles in the guest, where
+ * the guest's own interrupts still wake it, rather than in the hypervisor.
+ * An event sent to it kicks it out with an NMI, so the VMX preemption
+ * timer is only armed for its next timer, if it has one. A domain that
+ * cannot kick also wakes it after XEN_WAIT_SLICE_NS (see end_block).
+ */
+void xen_exit_handler::block()
+{
+    auto info = m_domain->vcpu_info(m_vcpuid);
+
+    if (info == nullptr)
+        return;
+
+    __atomic_store_n(&info->evtchn_upcall_mask, 0, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&info->evtchn_upcall_pending, __ATOMIC_SEQ_CST) != 0)
+        return;
+
+    auto tsc = rdtsc();
+
+    m_wait.block();
+    m_runstate.block(tsc);
+    update_stats([](auto &stats) { stats.blocks++; });
+
+    m_blocked = true;
+    m_block_end = m_domain->kicks() ? ~0ULL : tsc + m_domain->clock().tsc(XEN_WAIT_SLICE_NS);
+
+    vmcs::guest_activity_state::set(vmcs::guest_activity_state::hlt);
+}
+
+/*
+ * Called on every exit while the vCPU is blocked, once its timers have been
+ * run. It stays halted through the preemption timer exits taken for its
+ * timers and the profiler, until one of them finds an event pending (a
+ * VIRQ_TIMER just raised, or an event another vCPU sent it that raced with
+ * the kick) or the slice, if any, is over; the last is a spurious wakeup to
+ * the guest, which checks for events itself. Any other exit, the kick's NMI
+ * among them, means the guest is already running again, or about to be.
+ */
+void xen_exit_handler::end_block(intel_x64::vmcs::value_type reason, uint64_t tsc)
+{
+    if (reason == vmcs::exit_reason::basic_exit_reason::preemption_timer_expired && tsc < m_block_end) {
+        auto info = m_domain->vcpu_info(m_vcpuid);
+
+        if (info != nullptr && __atomic_load_n(&info->evtchn_upcall_pending, __ATOMIC_SEQ_CST) == 0 &&
+            vmcs::guest_activity_state::get() == vmcs::guest_activity_state::hlt)
+            return;
+    }
+
+    if (vmcs::guest_activity_state::get() != vmcs::guest_activity_state::active)
+        vmcs::guest_activity_state::set(vmcs::guest_activity_state::active);
+
+    m_blocked = false;
+
+    auto woken = m_wait.unblock();
+
+    if (woken != 0) {
+        auto latency = tsc > woken ? m_domain->clock().ns(tsc - woken) : 0;
+
+        update_stats([&](auto &stats) {
+            stats.wakeups++;
+            stats.wake_latency_ns += latency;
+        });
+    }
+}
@@ -0,0 +1,160 @@
+#include <exit_handler/xen_tbuf.h>
+#include <exit_handler/xen_evtchn.h>
+#include <exit_handler/xen_exit_handler.h>
+#include <memory_manager/memory_manager_x64.h>
+
+static_assert(sizeof(t_info) + XEN_TBUF_MAX_VCPUS * sizeof(uint16_t) +
+              XEN_TBUF_MAX_VCPUS * XEN_TBUF_PAGES * sizeof(uint32_t) + sizeof(uint32_t) <= PAGE_SIZE,
+              "the trace buffer frame lists must fit in one t_info page");
+
+static uint32_t record_size(uint32_t nr_extra, bool cycles)
+{ return static_cast<uint32_t>(sizeof(uint32_t) * (1 + nr_extra) + (cycles ? sizeof(uint64_t) : 0)); }
+
+xen_tbuf_ring::xen_tbuf_ring(uint64_t vcpuid, const std::atomic<bool> &enabled, xen_evtchn &evtchn) :
+    m_vcpuid(vcpuid),
+    m_enabled(enabled),
+    m_evtchn(evtchn),
+    m_lost(0),
+    m_first_lost_tsc(0),
+    m_signalled(false)
+{
+    m_pages = std::make_unique<uint8_t[]>(XEN_TBUF_PAGES * PAGE_SIZE);
+    memset(m_pages.get(), 0, XEN_TBUF_PAGES * PAGE_SIZE);
+
+    m_buf = reinterpret_cast<t_buf *>(m_pages.get());
+    m_data = m_pages.get() + sizeof(t_buf);
+    m_data_size = XEN_TBUF_PAGES * PAGE_SIZE - sizeof(t_buf);
+}
+
+uintptr_t xen_tbuf_ring::page_maddr(unsigned int page) const
+{ return g_mm->virtptr_to_physint(m_pages.get() + page * PAGE_SIZE); }
+
+uint32_t xen_tbuf_ring::unconsumed() const
+{
+    auto cons = __atomic_load_n(&m_buf->cons, __ATOMIC_ACQUIRE);
+    auto prod = m_buf->prod;
+
+    return prod >= cons ? prod - cons : prod + 2 * m_data_size - cons;
+}
+
+void xen_tbuf_ring::record(uint32_t event, const uint32_t *extra, uint32_t nr_extra)
+{
+    if (m_lost != 0) {
+        uint32_t lost[] = {
+            m_lost,
+            static_cast<uint16_t>(m_vcpuid),
+            static_cast<uint32_t>(m_first_lost_tsc),
+            static_cast<uint32_t>(m_first_lost_tsc >> 32)
+        };
+
+        if (!insert(TRC_LOST_RECORDS, lost, 4, true)) {
+            m_lost++;
+            return;
+        }
+
+        m_lost = 0;
+    }
+
+    if (!insert(event, extra, nr_extra, true)) {
+        if (m_lost++ == 0)
+            m_first_lost_tsc = rdtsc();
+        return;
+    }
+
+    // Signal the consumer once per crossing of the half-full mark.
+    if (unconsumed() >= m_data_size / 2) {
+        if (!m_signalled)
+            m_signalled = m_evtchn.raise_virq(VIRQ_TBUF, 0);
+    }
+    else {
+        m_signalled = false;
+    }
+}
+
+bool xen_tbuf_ring::insert(uint32_t event, const uint32_t *extra, uint32_t nr_extra, bool cycles)
+{
+    auto size = record_size(nr_extra, cycles);
+    auto prod = m_buf->prod;
+    auto offset = prod >= m_data_size ? prod - m_data_size : prod;
+    auto to_wrap = m_data_size - offset;
+    auto needed = size + (to_wrap < size ? to_wrap : 0);
+
+    if (unconsumed() + needed > m_data_size)
+        return false;
+
+    // Pad to the end of the buffer with a wrap record, adding a timestamp
+    // if the padding is too big for the extra words alone.
+    if (to_wrap < size) {
+        auto wrap_extra = (to_wrap - sizeof(uint32_t)) / sizeof(uint32_t);
+        auto wrap_cycles = wrap_extra > TRACE_EXTRA_MAX;
+
+        write(TRC_TRACE_WRAP_BUFFER, nullptr, wrap_cycles ? wrap_extra - 2 : wrap_extra, wrap_cycles);
+    }
+
+    write(event, extra, nr_extra, cycles);
+    return true;
+}
+
+void xen_tbuf_ring::write(uint32_t event, const uint32_t *extra, uint32_t nr_extra, bool cycles)
+{
+    auto prod = m_buf->prod;
+    auto offset = prod >= m_data_size ? prod - m_data_size : prod;
+    auto rec = reinterpret_cast<uint32_t *>(m_data + offset);
+    auto size = record_size(nr_extra, cycles);
+
+    *rec++ = event | nr_extra << TRACE_EXTRA_SHIFT | (cycles ? 1U : 0U) << 31;
+
+    if (cycles) {
+        auto tsc = rdtsc();
+
+        *rec++ = static_cast<uint32_t>(tsc);
+        *rec++ = static_cast<uint32_t>(tsc >> 32);
+    }
+
+    for (auto i = 0U; i < nr_extra; i++)
+        rec[i] = extra != nullptr ? extra[i] : 0;
+
+    prod += size;
+
+    if (prod >= 2 * m_data_size)
+        prod -= 2 * m_data_size;
+
+    __atomic_store_n(&m_buf->prod, prod, __ATOMIC_RELEASE);
+}
+
+xen_tbuf::xen_tbuf(xen_evtchn &evtchn) :
+    m_evtchn(evtchn),
+    m_enabled(false)
+{
+    m_t_info_page = std::make_unique<uint8_t[]>(PAGE_SIZE);
+    memset(m_t_info_page.get(), 0, PAGE_SIZE);
+
+    m_t_info = reinterpret_cast<t_info *>(m_t_info_page.get());
+    m_t_info->tbuf_size = XEN_TBUF_PAGES;
+    m_t_info_maddr = g_mm->virtptr_to_physint(m_t_info_page.get());
+
+    // Frame lists start after the offset table, in uint32_t units.
+    m_next_offset = static_cast<uint16_t>((sizeof(t_info) + XEN_TBUF_MAX_VCPUS * sizeof(uint16_t) +
+                                           sizeof(uint32_t) - 1) / sizeof(uint32_t));
+}
+
+xen_tbuf_ring *xen_tbuf::ring(uint64_t vcpuid)
+{
+    if (vcpuid >= XEN_TBUF_MAX_VCPUS)
+        return nullptr;
+
+    if (!m_rings[vcpuid]) {
+        auto &&ring = std::make_unique<xen_tbuf_ring>(vcpuid, m_enabled, m_evtchn);
+        auto mfns = reinterpret_cast<uint32_t *>(m_t_info) + m_next_offset;
+
+        for (auto i = 0U; i < XEN_TBUF_PAGES; i++)
+            mfns[i] = static_cast<uint32_t>(ring->page_maddr(i) >> 12);
+
+        m_t_info->mfn_offset[vcpuid] = m_next_offset;
+        m_next_offset += XEN_TBUF_PAGES;
+
+        m_rings[vcpuid] = std::move(ring);
+    }
+
+    return m_rings[vcpuid].get();
+}
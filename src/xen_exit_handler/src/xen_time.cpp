@@ -0,0 +1,61 @@
+#include <exit_handler/xen_time.h>
+
+static void cpuid(uint32_t leaf, uint32_t &eax, uint32_t &ebx, uint32_t &ecx)
+{
+    uint32_t edx;
+
+    asm volatile ("cpuid"
+                  : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                  : "a" (leaf), "c" (0));
+}
+
+static uint64_t tsc_khz()
+{
+    uint32_t max_leaf, eax, ebx, ecx;
+
+    cpuid(0, max_leaf, ebx, ecx);
+
+    // TSC = crystal * ebx / eax, where the crystal frequency is given.
+    if (max_leaf >= 0x15) {
+        cpuid(0x15, eax, ebx, ecx);
+
+        if (eax != 0 && ebx != 0 && ecx != 0)
+            return static_cast<uint64_t>(ecx) * ebx / eax / 1000;
+    }
+
+    // Otherwise the base frequency, in MHz, which the TSC runs at.
+    if (max_leaf >= 0x16) {
+        cpuid(0x16, eax, ebx, ecx);
+
+        if ((eax & 0xFFFF) != 0)
+            return static_cast<uint64_t>(eax & 0xFFFF) * 1000;
+    }
+
+    return XEN_TSC_DEFAULT_KHZ;
+}
+
+/*
+ * As Xen's set_time_scale(): the TSC rate is shifted into (1, 2] GHz so
+ * that the multiplier, a 0.32 fraction of nanoseconds per shifted tick,
+ * fits in 32 bits. The tick is only shifted left by at most 31.
+ */
+xen_tsc_clock::xen_tsc_clock() :
+    m_khz(tsc_khz())
+{
+    auto tps = m_khz * 1000;
+    int shift = 0;
+
+    while (tps > 2000000000ULL) {
+        tps >>= 1;
+        shift--;
+    }
+
+    while (tps <= 1000000000ULL && shift < 31) {
+        tps <<= 1;
+        shift++;
+    }
+
+    m_mul = static_cast<uint32_t>((1000000000ULL << 32) / tps);
+    m_shift = static_cast<int8_t>(shift);
+    m_tsc_per_ns = (m_khz << 32) / 1000000ULL;
+}
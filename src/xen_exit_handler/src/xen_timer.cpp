@@ -0,0 +1,241 @@
+#include <exit_handler/xen_timer.h>
+
+#define XEN_TIMER_SLOT_MASK (XEN_TIMER_SLOTS - 1ULL)
+
+xen_timer_wheel::xen_timer_wheel(uint64_t tick_cycles) :
+    m_shift(0),
+    m_now(0),
+    m_deadline(~0ULL),
+    m_occupied(),
+    m_slots()
+{
+    while ((2ULL << m_shift) <= tick_cycles)
+        m_shift++;
+}
+
+void xen_timer_wheel::set(xen_timer &timer, uint64_t expires, uint64_t tsc)
+{
+    if (timer.pending())
+        cancel(timer);
+
+    // Nothing is placed relative to m_now while the wheel is empty, so it
+    // can be brought up to date.
+    if (empty() && m_now < (tsc >> m_shift))
+        m_now = tsc >> m_shift;
+
+    timer.tick = (expires >> m_shift) + ((expires & ((1ULL << m_shift) - 1)) != 0);
+    place(timer);
+
+    if ((timer.tick << m_shift) < m_deadline)
+        m_deadline = timer.tick << m_shift;
+}
+
+void xen_timer_wheel::cancel(xen_timer &timer)
+{
+    if (!timer.pending())
+        return;
+
+    *timer.pprev = timer.next;
+
+    if (timer.next != nullptr)
+        timer.next->pprev = timer.pprev;
+
+    if (m_slots[timer.level][timer.slot] == nullptr)
+        m_occupied[timer.level] &= ~(1ULL << timer.slot);
+
+    timer.next = nullptr;
+    timer.pprev = nullptr;
+
+    if (timer.tick << m_shift == m_deadline)
+        update_deadline();
+}
+
+void xen_timer_wheel::place(xen_timer &timer)
+{
+    auto tick = timer.tick > m_now ? timer.tick : m_now;
+    auto delta = tick - m_now;
+    auto level = 0U;
+
+    while (level + 1 < XEN_TIMER_LEVELS && (delta >> (XEN_TIMER_SLOT_BITS * (level + 1))) != 0)
+        level++;
+
+    if ((delta >> (XEN_TIMER_SLOT_BITS * XEN_TIMER_LEVELS)) != 0)
+        tick = m_now + (1ULL << (XEN_TIMER_SLOT_BITS * XEN_TIMER_LEVELS)) - 1;
+
+    auto slot = static_cast<uint32_t>((tick >> (XEN_TIMER_SLOT_BITS * level)) & XEN_TIMER_SLOT_MASK);
+    auto &head = m_slots[level][slot];
+
+    timer.next = head;
+    timer.pprev = &head;
+    timer.level = level;
+    timer.slot = slot;
+
+    if (head != nullptr)
+        head->pprev = &timer.next;
+
+    head = &timer;
+    m_occupied[level] |= 1ULL << slot;
+}
+
+bool xen_timer_wheel::empty() const
+{
+    for (auto occupied : m_occupied) {
+        if (occupied != 0)
+            return false;
+    }
+
+    return true;
+}
+
+// Moves the timers in each level's slot that starts at m_now down to the
+// levels below.
+void xen_timer_wheel::cascade()
+{
+    for (auto level = 1U; level < XEN_TIMER_LEVELS; level++) {
+        auto shift = XEN_TIMER_SLOT_BITS * level;
+
+        if ((m_now & ((1ULL << shift) - 1)) != 0)
+            break;
+
+        auto timer = take(level, static_cast<uint32_t>((m_now >> shift) & XEN_TIMER_SLOT_MASK));
+
+        while (timer != nullptr) {
+            auto next = timer->next;
+
+            place(*timer);
+            timer = next;
+        }
+    }
+}
+
+xen_timer *xen_timer_wheel::take(uint32_t level, uint32_t slot)
+{
+    auto head = m_slots[level][slot];
+
+    m_slots[level][slot] = nullptr;
+    m_occupied[level] &= ~(1ULL << slot);
+
+    return head;
+}
+
+// Finds the level's next occupied slot after m_now, and the tick at which
+// it starts. Returns XEN_TIMER_SLOTS if the level is empty.
+uint32_t xen_timer_wheel::first_slot(uint32_t level, uint64_t &tick) const
+{
+    auto occupied = m_occupied[level];
+
+    if (occupied == 0)
+        return XEN_TIMER_SLOTS;
+
+    auto shift = XEN_TIMER_SLOT_BITS * level;
+    auto base = m_now >> shift;
+    auto first = base & XEN_TIMER_SLOT_MASK;
+    auto rotation = base - first;
+
+    // A slot that started before m_now has already been cascaded, so
+    // anything in it is due the next time round.
+    if ((base << shift) != m_now)
+        first++;
+
+    auto ahead = first < XEN_TIMER_SLOTS ? occupied & (~0ULL << first) : 0;
+
+    if (ahead == 0) {
+        ahead = occupied;
+        rotation += XEN_TIMER_SLOTS;
+    }
+
+    auto slot = static_cast<uint32_t>(__builtin_ctzll(ahead));
+
+    tick = (rotation + slot) << shift;
+    return slot;
+}
+
+uint64_t xen_timer_wheel::next_tick() const
+{
+    auto next = ~0ULL;
+
+    for (auto level = 0U; level < XEN_TIMER_LEVELS; level++) {
+        uint64_t tick;
+
+        if (first_slot(level, tick) != XEN_TIMER_SLOTS && tick < next)
+            next = tick;
+    }
+
+    return next;
+}
+
+// Below the top level, a level's first occupied slot holds its earliest
+// timers, so only those are looked at. Timers beyond the wheel's reach sit
+// in whichever top-level slot was the last when they were placed, so the
+// top level is searched in full.
+void xen_timer_wheel::update_deadline()
+{
+    auto deadline = ~0ULL;
+    auto earliest = [&](xen_timer *timer) {
+        for (; timer != nullptr; timer = timer->next) {
+            if (timer->tick < deadline)
+                deadline = timer->tick;
+        }
+    };
+
+    for (auto level = 0U; level < XEN_TIMER_LEVELS - 1; level++) {
+        uint64_t tick;
+        auto slot = first_slot(level, tick);
+
+        if (slot != XEN_TIMER_SLOTS)
+            earliest(m_slots[level][slot]);
+    }
+
+    for (auto occupied = m_occupied[XEN_TIMER_LEVELS - 1]; occupied != 0; occupied &= occupied - 1)
+        earliest(m_slots[XEN_TIMER_LEVELS - 1][__builtin_ctzll(occupied)]);
+
+    m_deadline = deadline != ~0ULL ? deadline << m_shift : ~0ULL;
+}
+
+xen_vcpu_timers::xen_vcpu_timers(const xen_tsc_clock &clock) :
+    m_clock(clock),
+    m_wheel(clock.tsc(XEN_TIMER_SLOP_NS)),
+    m_period(0)
+{ }
+
+// Converted relative to now, which keeps rounding out of absolute times.
+uint64_t xen_vcpu_timers::cycles_until(uint64_t timeout, uint64_t tsc) const
+{
+    auto now = m_clock.ns(tsc);
+
+    if (timeout <= now)
+        return 0;
+
+    return m_clock.tsc(timeout - now < XEN_TIMER_MAX_NS ? timeout - now : XEN_TIMER_MAX_NS);
+}
+
+void xen_vcpu_timers::set_singleshot(uint64_t timeout, uint64_t tsc)
+{ m_wheel.set(m_singleshot, tsc + cycles_until(timeout, tsc), tsc); }
+
+void xen_vcpu_timers::stop_singleshot()
+{ m_wheel.cancel(m_singleshot); }
+
+void xen_vcpu_timers::set_periodic(uint64_t period, uint64_t tsc)
+{
+    m_period = m_clock.tsc(period < XEN_TIMER_MAX_NS ? period : XEN_TIMER_MAX_NS);
+    m_wheel.set(m_periodic, tsc + m_period, tsc);
+}
+
+void xen_vcpu_timers::stop_periodic()
+{ m_wheel.cancel(m_periodic); }
+
+// As in Xen, a periodic timer that has fallen behind skips the periods it
+// missed rather than firing for each of them.
+bool xen_vcpu_timers::expire(uint64_t tsc)
+{
+    auto fired = false;
+
+    m_wheel.expire(tsc, [&](xen_timer &timer) {
+        if (&timer == &m_periodic)
+            m_wheel.set(m_periodic, tsc + m_period, tsc);
+
+        fired = true;
+    });
+
+    return fired;
+}
@@ -0,0 +1,99 @@
+#include <exit_handler/xen_exit_handler.h>
+#include <exit_handler/xen_domain.h>
+#include <xen.h>
+#include <xen_errno.h>
+#include <xen_hypercalls.h>
+#include <xen_vcpu.h>
+
+long xen_exit_handler::handle_vcpu_op(vmcall_registers_t &regs)
+{
+    auto vcpuid = regs.r02;
+
+    switch (regs.r01) {
+    case VCPUOP_register_vcpu_info: {
+        auto imap = map_guest<vcpu_register_vcpu_info>(regs.r03);
+        auto op = imap.get();
+
+        return m_domain->register_vcpu_info(vcpuid, op->mfn, op->offset);
+    }
+
+    case VCPUOP_register_runstate_memory_area: {
+        auto imap = map_guest<vcpu_register_runstate_memory_area>(regs.r03);
+        auto runstate = m_domain->runstate(vcpuid);
+
+        if (runstate == nullptr)
+            return -XEN_ENOENT;
+
+        // Mapped once, by this vCPU's CR3: the area is in the kernel's
+        // per-CPU data, which every vCPU maps the same way. As in Xen, a
+        // NULL address unregisters it.
+        auto addr = imap.get()->addr.p;
+
+        if (addr == 0)
+            runstate->register_area(bfn::unique_map_ptr_x64<vcpu_runstate_info>());
+        else
+            runstate->register_area(map_guest<vcpu_runstate_info>(addr));
+
+        return 0;
+    }
+
+    case VCPUOP_get_runstate_info: {
+        auto imap = map_guest<vcpu_runstate_info>(regs.r03);
+        auto runstate = m_domain->runstate(vcpuid);
+
+        if (runstate == nullptr)
+            return -XEN_ENOENT;
+
+        *imap.get() = runstate->info();
+        return 0;
+    }
+
+    // The timers belong to the vCPU's own handler, so, as Xen does for the
+    // single-shot timer, only the calling vCPU may set its timers.
+    case VCPUOP_set_periodic_timer: {
+        if (vcpuid != m_vcpuid)
+            return -XEN_EINVAL;
+
+        auto imap = map_guest<vcpu_set_periodic_timer>(regs.r03);
+        auto period = imap.get()->period_ns;
+
+        if (period < XEN_TIMER_MIN_PERIOD_NS)
+            return -XEN_EINVAL;
+
+        m_timers.set_periodic(period, rdtsc());
+        return 0;
+    }
+
+    case VCPUOP_stop_periodic_timer:
+        if (vcpuid != m_vcpuid)
+            return -XEN_EINVAL;
+
+        m_timers.stop_periodic();
+        return 0;
+
+    case VCPUOP_set_singleshot_timer: {
+        if (vcpuid != m_vcpuid)
+            return -XEN_EINVAL;
+
+        auto imap = map_guest<vcpu_set_singleshot_timer>(regs.r03);
+        auto op = imap.get();
+        auto tsc = rdtsc();
+
+        if ((op->flags & VCPU_SSHOTTMR_future) != 0 && op->timeout_abs_ns < m_domain->clock().ns(tsc))
+            return -XEN_ETIME;
+
+        m_timers.set_singleshot(op->timeout_abs_ns, tsc);
+        return 0;
+    }
+
+    case VCPUOP_stop_singleshot_timer:
+        if (vcpuid != m_vcpuid)
+            return -XEN_EINVAL;
+
+        m_timers.stop_singleshot();
+        return 0;
+
+    default:
+        return -XEN_ENOSYS;
+    }
+}
@@ -0,0 +1,59 @@
+#include <exit_handler/xen_vcpu_pool.h>
+
+void xen_vcpu_pool::reserve(size_t count, size_t size)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_block || count == 0)
+        return;
+
+    auto slot_size = (size + XEN_CACHE_LINE - 1) & ~static_cast<size_t>(XEN_CACHE_LINE - 1);
+
+    m_block = std::make_unique<uint8_t[]>(count * slot_size + XEN_CACHE_LINE - 1);
+
+    auto addr = reinterpret_cast<uintptr_t>(m_block.get());
+    m_slots = m_block.get() + (-addr & (XEN_CACHE_LINE - 1));
+    m_slot_size = slot_size;
+    m_count = count;
+
+    // Threaded so the first vCPU gets the first slot.
+    for (auto i = count; i > 0; i--) {
+        auto free_slot = reinterpret_cast<slot *>(m_slots + (i - 1) * slot_size);
+        free_slot->next = m_head;
+        m_head = free_slot;
+    }
+
+    m_available = count;
+}
+
+void *xen_vcpu_pool::alloc(size_t size)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_head == nullptr || size > m_slot_size)
+        return nullptr;
+
+    auto used = m_head;
+    m_head = used->next;
+    m_available--;
+
+    return used;
+}
+
+bool xen_vcpu_pool::free(void *ptr)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto addr = reinterpret_cast<uintptr_t>(ptr);
+    auto base = reinterpret_cast<uintptr_t>(m_slots);
+
+    if (addr < base || addr >= base + m_count * m_slot_size)
+        return false;
+
+    auto freed = static_cast<slot *>(ptr);
+    freed->next = m_head;
+    m_head = freed;
+    m_available++;
+
+    return true;
+}
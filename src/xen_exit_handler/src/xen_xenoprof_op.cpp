@@ -0,0 +1,88 @@
+#include <cstring>
+#include <exit_handler/xen_exit_handler.h>
+#include <exit_handler/xen_domain.h>
+#include <xen.h>
+#include <xen_errno.h>
+#include <xen_hypercalls.h>
+#include <xen_xenoprof.h>
+
+/*
+ * A timer-mode subset of xenoprof: there are no hardware counters and only
+ * this domain is profiled, so the domain and counter setup ops succeed
+ * without doing anything. Counter 0's count sets the sampling period in TSC
+ * cycles. get_buffer returns the calling vCPU's buffer only (nbuf is
+ * always 1), as the buffers are single pages that are not physically
+ * contiguous; the guest asks for each vCPU's buffer on that vCPU.
+ */
+long xen_exit_handler::handle_xenoprof_op(vmcall_registers_t &regs)
+{
+    auto &&oprof = m_domain->oprof();
+
+    switch (regs.r01) {
+    case XENOPROF_init: {
+        auto imap = map_guest<xenoprof_init>(regs.r02);
+        auto op = imap.get();
+
+        op->num_events = 1;
+        op->is_primary = 1;
+        strncpy(op->cpu_type, "timer", sizeof(op->cpu_type) - 1);
+        return 0;
+    }
+
+    case XENOPROF_get_buffer: {
+        auto imap = map_guest<xenoprof_get_buffer>(regs.r02);
+        auto op = imap.get();
+
+        if (m_oprof == nullptr)
+            return -XEN_ENOMEM;
+
+        op->max_samples = static_cast<int32_t>(m_oprof->size());
+        op->nbuf = 1;
+        op->bufsize = PAGE_SIZE;
+        op->buf_gmaddr = m_oprof->maddr();
+        return 0;
+    }
+
+    case XENOPROF_counter: {
+        auto imap = map_guest<xenoprof_counter>(regs.r02);
+        auto op = imap.get();
+
+        if (op->ind != 0)
+            return -XEN_EINVAL;
+
+        return op->enabled != 0 ? oprof.set_period(op->count) : 0;
+    }
+
+    case XENOPROF_reset_active_list:
+    case XENOPROF_reset_passive_list:
+    case XENOPROF_set_active:
+    case XENOPROF_set_passive:
+    case XENOPROF_reserve_counters:
+    case XENOPROF_setup_events:
+    case XENOPROF_release_counters:
+        return 0;
+
+    case XENOPROF_enable_virq:
+        oprof.enable_virq(true);
+        return 0;
+
+    case XENOPROF_disable_virq:
+        oprof.enable_virq(false);
+        return 0;
+
+    case XENOPROF_start:
+        return oprof.start();
+
+    case XENOPROF_stop:
+        oprof.stop();
+        return 0;
+
+    case XENOPROF_shutdown:
+        oprof.stop();
+        oprof.enable_virq(false);
+        return 0;
+
+    default:
+        return -XEN_ENOSYS;
+    }
+}
@@ -0,0 +1,94 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exit_handler/xen_page_ops.h>
+
+// Compares the page kernels on 4 KiB pages, with a working set that stays
+// in cache and one that does not. Output is CSV:
+//
+//     kernel,op,working_set_kb,cycles_per_page
+
+static constexpr const size_t page_size = 4096;
+static constexpr const size_t iterations = 64;
+
+static uint64_t rdtsc_ordered()
+{
+    uint32_t low, high;
+
+    asm volatile ("lfence\n\t"
+                  "rdtsc"
+                  : "=a" (low), "=d" (high)
+                  :
+                  : "memory");
+    return low | static_cast<uint64_t>(high) << 32;
+}
+
+static void bench(const xen_page_kernel &kernel, uint8_t *dst, uint8_t *src, size_t pages)
+{
+    auto clear_cycles = ~0ULL;
+    auto copy_cycles = ~0ULL;
+
+    for (auto i = 0UL; i < iterations; i++) {
+        auto start = rdtsc_ordered();
+        for (auto p = 0UL; p < pages; p++)
+            kernel.clear(dst + p * page_size);
+        auto elapsed = rdtsc_ordered() - start;
+
+        if (elapsed < clear_cycles)
+            clear_cycles = elapsed;
+
+        start = rdtsc_ordered();
+        for (auto p = 0UL; p < pages; p++)
+            kernel.copy(dst + p * page_size, src + p * page_size);
+        elapsed = rdtsc_ordered() - start;
+
+        if (elapsed < copy_cycles)
+            copy_cycles = elapsed;
+    }
+
+    printf("%s,clear,%zu,%llu\n", kernel.name, pages * page_size / 1024,
+           clear_cycles / pages);
+    printf("%s,copy,%zu,%llu\n", kernel.name, pages * page_size / 1024,
+           copy_cycles / pages);
+}
+
+int main()
+{
+    const size_t working_sets[] = { 8, 8192 };
+    const size_t max_pages = 8192;
+
+    auto dst = static_cast<uint8_t *>(aligned_alloc(page_size, max_pages * page_size));
+    auto src = static_cast<uint8_t *>(aligned_alloc(page_size, max_pages * page_size));
+
+    if (dst == nullptr || src == nullptr)
+        return 1;
+
+    memset(dst, 0x5a, max_pages * page_size);
+    memset(src, 0xa5, max_pages * page_size);
+
+    printf("kernel,op,working_set_kb,cycles_per_page\n");
+
+    for (auto i = 0UL; i < g_nr_page_kernels; i++) {
+        const auto &kernel = g_page_kernels[i];
+
+        if (!kernel.supported())
+            continue;
+
+        for (auto pages : working_sets)
+            bench(kernel, dst, src, pages);
+
+        kernel.clear(dst);
+        kernel.copy(dst + page_size, src);
+
+        if (dst[page_size - 1] != 0 || memcmp(dst + page_size, src, page_size) != 0) {
+            fprintf(stderr, "%s: wrong result\n", kernel.name);
+            return 1;
+        }
+    }
+
+    free(dst);
+    free(src);
+
+    return 0;
+}
@@ -0,0 +1,426 @@
+#include <cstdint>
+#include <exit_handler/xen_page_ops.h>
+
+static constexpr const size_t page_size = 4096;
+
+struct cpu_features
+{
+    bool erms;
+    bool avx2;
+    bool avx512;
+    bool zmm_state;
+};
+
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+    asm volatile ("cpuid"
+                  : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+                  : "a" (leaf), "c" (subleaf)
+                  );
+}
+
+static uint64_t xgetbv(uint32_t xcr)
+{
+    uint32_t low, high;
+
+    asm volatile ("xgetbv"
+                  : "=a" (low), "=d" (high)
+                  : "c" (xcr)
+                  );
+    return low | static_cast<uint64_t>(high) << 32;
+}
+
+static cpu_features detect_features()
+{
+    uint32_t regs[4];
+    cpu_features features = {};
+
+    cpuid(0, 0, regs);
+    if (regs[0] < 7)
+        return features;
+
+    cpuid(1, 0, regs);
+    auto osxsave = (regs[2] & (1U << 27)) != 0;
+    auto xcr0 = osxsave ? xgetbv(0) : 0;
+
+    cpuid(7, 0, regs);
+    features.erms = (regs[1] & (1U << 9)) != 0;
+    features.avx2 = (regs[1] & (1U << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+    features.zmm_state = (xcr0 & 0xe6) == 0xe6;
+    features.avx512 = (regs[1] & (1U << 16)) != 0 && features.zmm_state;
+
+    return features;
+}
+
+static const cpu_features &features()
+{
+    static cpu_features features = detect_features();
+    return features;
+}
+
+static bool always_supported()
+{ return true; }
+
+static bool erms_supported()
+{ return features().erms; }
+
+static bool avx2_supported()
+{ return features().avx2; }
+
+static bool avx512_supported()
+{ return features().avx512; }
+
+// -----------------------------------------------------------------------------
+// String instructions (no vector state)
+// -----------------------------------------------------------------------------
+
+static void clear_rep_stosq(void *dst)
+{
+    auto n = page_size / 8;
+
+    asm volatile ("rep stosq"
+                  : "+D" (dst), "+c" (n)
+                  : "a" (0UL)
+                  : "memory");
+}
+
+static void copy_rep_movsq(void *dst, const void *src)
+{
+    auto n = page_size / 8;
+
+    asm volatile ("rep movsq"
+                  : "+D" (dst), "+S" (src), "+c" (n)
+                  :
+                  : "memory");
+}
+
+static void clear_erms(void *dst)
+{
+    auto n = page_size;
+
+    asm volatile ("rep stosb"
+                  : "+D" (dst), "+c" (n)
+                  : "a" (0UL)
+                  : "memory");
+}
+
+static void copy_erms(void *dst, const void *src)
+{
+    auto n = page_size;
+
+    asm volatile ("rep movsb"
+                  : "+D" (dst), "+S" (src), "+c" (n)
+                  :
+                  : "memory");
+}
+
+static void clear_movnti(void *dst)
+{
+    auto n = page_size / 64;
+
+    asm volatile ("1:\n\t"
+                  "movnti %[zero], 0(%[dst])\n\t"
+                  "movnti %[zero], 8(%[dst])\n\t"
+                  "movnti %[zero], 16(%[dst])\n\t"
+                  "movnti %[zero], 24(%[dst])\n\t"
+                  "movnti %[zero], 32(%[dst])\n\t"
+                  "movnti %[zero], 40(%[dst])\n\t"
+                  "movnti %[zero], 48(%[dst])\n\t"
+                  "movnti %[zero], 56(%[dst])\n\t"
+                  "add $64, %[dst]\n\t"
+                  "dec %[n]\n\t"
+                  "jnz 1b\n\t"
+                  "sfence\n\t"
+                  : [dst] "+r" (dst), [n] "+r" (n)
+                  : [zero] "r" (0UL)
+                  : "memory", "cc");
+}
+
+static void copy_movnti(void *dst, const void *src)
+{
+    auto n = page_size / 32;
+
+    asm volatile ("1:\n\t"
+                  "mov 0(%[src]), %%r8\n\t"
+                  "mov 8(%[src]), %%r9\n\t"
+                  "mov 16(%[src]), %%r10\n\t"
+                  "mov 24(%[src]), %%r11\n\t"
+                  "movnti %%r8, 0(%[dst])\n\t"
+                  "movnti %%r9, 8(%[dst])\n\t"
+                  "movnti %%r10, 16(%[dst])\n\t"
+                  "movnti %%r11, 24(%[dst])\n\t"
+                  "add $32, %[src]\n\t"
+                  "add $32, %[dst]\n\t"
+                  "dec %[n]\n\t"
+                  "jnz 1b\n\t"
+                  "sfence\n\t"
+                  : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (n)
+                  :
+                  : "memory", "cc", "r8", "r9", "r10", "r11");
+}
+
+// -----------------------------------------------------------------------------
+// AVX2
+// -----------------------------------------------------------------------------
+
+// A VEX write to ymmN zeroes bits 511:256 of zmmN, so when the OS has AVX-512
+// state enabled the full zmm registers are saved instead.
+
+#define SAVE_YMM0_3                                 \
+    "test %[zmm], %[zmm]\n\t"                       \
+    "jnz 10f\n\t"                                   \
+    "vmovdqu %%ymm0, 0(%[save])\n\t"                \
+    "vmovdqu %%ymm1, 32(%[save])\n\t"               \
+    "vmovdqu %%ymm2, 64(%[save])\n\t"               \
+    "vmovdqu %%ymm3, 96(%[save])\n\t"               \
+    "jmp 11f\n\t"                                   \
+    "10:\n\t"                                       \
+    "vmovdqu64 %%zmm0, 0(%[save])\n\t"              \
+    "vmovdqu64 %%zmm1, 64(%[save])\n\t"             \
+    "vmovdqu64 %%zmm2, 128(%[save])\n\t"            \
+    "vmovdqu64 %%zmm3, 192(%[save])\n\t"            \
+    "11:\n\t"
+
+#define RESTORE_YMM0_3                              \
+    "test %[zmm], %[zmm]\n\t"                       \
+    "jnz 12f\n\t"                                   \
+    "vmovdqu 0(%[save]), %%ymm0\n\t"                \
+    "vmovdqu 32(%[save]), %%ymm1\n\t"               \
+    "vmovdqu 64(%[save]), %%ymm2\n\t"               \
+    "vmovdqu 96(%[save]), %%ymm3\n\t"               \
+    "jmp 13f\n\t"                                   \
+    "12:\n\t"                                       \
+    "vmovdqu64 0(%[save]), %%zmm0\n\t"              \
+    "vmovdqu64 64(%[save]), %%zmm1\n\t"             \
+    "vmovdqu64 128(%[save]), %%zmm2\n\t"            \
+    "vmovdqu64 192(%[save]), %%zmm3\n\t"            \
+    "13:\n\t"
+
+#define AVX2_CLEAR(store, fence)                    \
+    SAVE_YMM0_3                                     \
+    "vpxor %%ymm0, %%ymm0, %%ymm0\n\t"              \
+    "1:\n\t"                                        \
+    store " %%ymm0, 0(%[dst])\n\t"                  \
+    store " %%ymm0, 32(%[dst])\n\t"                 \
+    store " %%ymm0, 64(%[dst])\n\t"                 \
+    store " %%ymm0, 96(%[dst])\n\t"                 \
+    "add $128, %[dst]\n\t"                          \
+    "dec %[n]\n\t"                                  \
+    "jnz 1b\n\t"                                    \
+    fence                                           \
+    RESTORE_YMM0_3
+
+#define AVX2_COPY(store, fence)                     \
+    SAVE_YMM0_3                                     \
+    "1:\n\t"                                        \
+    "vmovdqa 0(%[src]), %%ymm0\n\t"                 \
+    "vmovdqa 32(%[src]), %%ymm1\n\t"                \
+    "vmovdqa 64(%[src]), %%ymm2\n\t"                \
+    "vmovdqa 96(%[src]), %%ymm3\n\t"                \
+    store " %%ymm0, 0(%[dst])\n\t"                  \
+    store " %%ymm1, 32(%[dst])\n\t"                 \
+    store " %%ymm2, 64(%[dst])\n\t"                 \
+    store " %%ymm3, 96(%[dst])\n\t"                 \
+    "add $128, %[src]\n\t"                          \
+    "add $128, %[dst]\n\t"                          \
+    "dec %[n]\n\t"                                  \
+    "jnz 1b\n\t"                                    \
+    fence                                           \
+    RESTORE_YMM0_3
+
+static void clear_avx2(void *dst)
+{
+    alignas(64) uint8_t save[256];
+    auto n = page_size / 128;
+    uint64_t zmm = features().zmm_state;
+
+    asm volatile (AVX2_CLEAR("vmovdqa", "")
+                  : [dst] "+r" (dst), [n] "+r" (n)
+                  : [save] "r" (save), [zmm] "r" (zmm)
+                  : "memory", "cc");
+}
+
+static void copy_avx2(void *dst, const void *src)
+{
+    alignas(64) uint8_t save[256];
+    auto n = page_size / 128;
+    uint64_t zmm = features().zmm_state;
+
+    asm volatile (AVX2_COPY("vmovdqa", "")
+                  : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (n)
+                  : [save] "r" (save), [zmm] "r" (zmm)
+                  : "memory", "cc");
+}
+
+static void clear_avx2_nt(void *dst)
+{
+    alignas(64) uint8_t save[256];
+    auto n = page_size / 128;
+    uint64_t zmm = features().zmm_state;
+
+    asm volatile (AVX2_CLEAR("vmovntdq", "sfence\n\t")
+                  : [dst] "+r" (dst), [n] "+r" (n)
+                  : [save] "r" (save), [zmm] "r" (zmm)
+                  : "memory", "cc");
+}
+
+static void copy_avx2_nt(void *dst, const void *src)
+{
+    alignas(64) uint8_t save[256];
+    auto n = page_size / 128;
+    uint64_t zmm = features().zmm_state;
+
+    asm volatile (AVX2_COPY("vmovntdq", "sfence\n\t")
+                  : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (n)
+                  : [save] "r" (save), [zmm] "r" (zmm)
+                  : "memory", "cc");
+}
+
+// -----------------------------------------------------------------------------
+// AVX-512
+// -----------------------------------------------------------------------------
+
+#define SAVE_ZMM0_3                                 \
+    "vmovdqu64 %%zmm0, 0(%[save])\n\t"              \
+    "vmovdqu64 %%zmm1, 64(%[save])\n\t"             \
+    "vmovdqu64 %%zmm2, 128(%[save])\n\t"            \
+    "vmovdqu64 %%zmm3, 192(%[save])\n\t"
+
+#define RESTORE_ZMM0_3                              \
+    "vmovdqu64 0(%[save]), %%zmm0\n\t"              \
+    "vmovdqu64 64(%[save]), %%zmm1\n\t"             \
+    "vmovdqu64 128(%[save]), %%zmm2\n\t"            \
+    "vmovdqu64 192(%[save]), %%zmm3\n\t"
+
+#define AVX512_CLEAR(store, fence)                  \
+    SAVE_ZMM0_3                                     \
+    "vpxorq %%zmm0, %%zmm0, %%zmm0\n\t"             \
+    "1:\n\t"                                        \
+    store " %%zmm0, 0(%[dst])\n\t"                  \
+    store " %%zmm0, 64(%[dst])\n\t"                 \
+    store " %%zmm0, 128(%[dst])\n\t"                \
+    store " %%zmm0, 192(%[dst])\n\t"                \
+    "add $256, %[dst]\n\t"                          \
+    "dec %[n]\n\t"                                  \
+    "jnz 1b\n\t"                                    \
+    fence                                           \
+    RESTORE_ZMM0_3
+
+#define AVX512_COPY(store, fence)                   \
+    SAVE_ZMM0_3                                     \
+    "1:\n\t"                                        \
+    "vmovdqa64 0(%[src]), %%zmm0\n\t"               \
+    "vmovdqa64 64(%[src]), %%zmm1\n\t"              \
+    "vmovdqa64 128(%[src]), %%zmm2\n\t"             \
+    "vmovdqa64 192(%[src]), %%zmm3\n\t"             \
+    store " %%zmm0, 0(%[dst])\n\t"                  \
+    store " %%zmm1, 64(%[dst])\n\t"                 \
+    store " %%zmm2, 128(%[dst])\n\t"                \
+    store " %%zmm3, 192(%[dst])\n\t"                \
+    "add $256, %[src]\n\t"                          \
+    "add $256, %[dst]\n\t"                          \
+    "dec %[n]\n\t"                                  \
+    "jnz 1b\n\t"                                    \
+    fence                                           \
+    RESTORE_ZMM0_3
+
+static void clear_avx512(void *dst)
+{
+    alignas(64) uint8_t save[256];
+    auto n = page_size / 256;
+
+    asm volatile (AVX512_CLEAR("vmovdqa64", "")
+                  : [dst] "+r" (dst), [n] "+r" (n)
+                  : [save] "r" (save)
+                  : "memory", "cc");
+}
+
+static void copy_avx512(void *dst, const void *src)
+{
+    alignas(64) uint8_t save[256];
+    auto n = page_size / 256;
+
+    asm volatile (AVX512_COPY("vmovdqa64", "")
+                  : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (n)
+                  : [save] "r" (save)
+                  : "memory", "cc");
+}
+
+static void clear_avx512_nt(void *dst)
+{
+    alignas(64) uint8_t save[256];
+    auto n = page_size / 256;
+
+    asm volatile (AVX512_CLEAR("vmovntdq", "sfence\n\t")
+                  : [dst] "+r" (dst), [n] "+r" (n)
+                  : [save] "r" (save)
+                  : "memory", "cc");
+}
+
+static void copy_avx512_nt(void *dst, const void *src)
+{
+    alignas(64) uint8_t save[256];
+    auto n = page_size / 256;
+
+    asm volatile (AVX512_COPY("vmovntdq", "sfence\n\t")
+                  : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (n)
+                  : [save] "r" (save)
+                  : "memory", "cc");
+}
+
+// -----------------------------------------------------------------------------
+// Dispatch
+// -----------------------------------------------------------------------------
+
+// Within each group the first supported kernel wins. ERMS comes first for
+// the temporal group: it matches the wide kernels on 4 KiB pages without
+// touching vector state. Run the page benchmark before reordering.
+const xen_page_kernel g_page_kernels[] =
+{
+    { "erms", false, erms_supported, clear_erms, copy_erms },
+    { "avx512", false, avx512_supported, clear_avx512, copy_avx512 },
+    { "avx2", false, avx2_supported, clear_avx2, copy_avx2 },
+    { "rep_movsq", false, always_supported, clear_rep_stosq, copy_rep_movsq },
+
+    { "avx512_nt", true, avx512_supported, clear_avx512_nt, copy_avx512_nt },
+    { "avx2_nt", true, avx2_supported, clear_avx2_nt, copy_avx2_nt },
+    { "movnti", true, always_supported, clear_movnti, copy_movnti },
+};
+
+const size_t g_nr_page_kernels = sizeof(g_page_kernels) / sizeof(g_page_kernels[0]);
+
+const xen_page_kernel *select_page_kernel(bool non_temporal)
+{
+    for (auto i = 0UL; i < g_nr_page_kernels; i++) {
+        const auto &kernel = g_page_kernels[i];
+
+        if (kernel.non_temporal == non_temporal && kernel.supported())
+            return &kernel;
+    }
+
+    return nullptr;
+}
+
+static const xen_page_kernel *temporal_kernel()
+{
+    static auto kernel = select_page_kernel(false);
+    return kernel;
+}
+
+static const xen_page_kernel *non_temporal_kernel()
+{
+    static auto kernel = select_page_kernel(true);
+    return kernel;
+}
+
+void clear_page(void *dst)
+{ temporal_kernel()->clear(dst); }
+
+void copy_page(void *dst, const void *src)
+{ temporal_kernel()->copy(dst, src); }
+
+void clear_page_nt(void *dst)
+{ non_temporal_kernel()->clear(dst); }
+
+void copy_page_nt(void *dst, const void *src)
+{ non_temporal_kernel()->copy(dst, src); }
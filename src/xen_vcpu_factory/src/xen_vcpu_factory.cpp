@@ -1,13 +1,77 @@
 #include <vcpu/vcpu_factory.h>
 #include <vcpu/vcpu_intel_x64.h>
 #include <exit_handler/xen_exit_handler.h>
+#include <exit_handler/xen_domain.h>
+#include <exit_handler/xen_vcpu_config.h>
+
+// vCPUs are brought up one at a time, so the domain is built exactly once,
+// by whichever vCPU starts first, before any guest code can ask for it.
+static std::unique_ptr<xen_domain> g_domain;
+static const xen_vcpu_config g_build_config = xen_build_vcpu_config();
+
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t &eax, uint32_t &ebx, uint32_t &ecx)
+{
+    uint32_t edx;
+
+    asm volatile ("cpuid"
+                  : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                  : "a" (leaf), "c" (subleaf));
+}
+
+// The logical CPUs in this CPU's package, which Bareflank starts a vCPU on
+// each of: the count at the last level of the x2APIC topology leaf, or the
+// one in leaf 1 without it. Other packages' vCPUs come from the heap.
+static uint64_t nr_cpus()
+{
+    uint32_t max_leaf, eax, ebx, ecx;
+    uint64_t count = 0;
+
+    cpuid(0, 0, max_leaf, ebx, ecx);
+
+    if (max_leaf >= 0xB) {
+        for (auto level = 0U; level < 8; level++) {
+            cpuid(0xB, level, eax, ebx, ecx);
+
+            if (((ecx >> 8) & 0xFF) == 0)
+                break;
+
+            count = ebx & 0xFFFF;
+        }
+    }
+
+    if (count == 0) {
+        cpuid(1, 0, eax, ebx, ecx);
+        count = (ebx >> 16) & 0xFF;
+    }
+
+    if (count == 0)
+        return 1;
+
+    return count < XEN_MAX_VCPUS ? count : XEN_MAX_VCPUS;
+}
 
 std::unique_ptr<vcpu>
 vcpu_factory::make_vcpu(vcpuid::type vcpuid, user_data *data)
 {
-    auto &&my_exit_handler = std::make_unique<xen_exit_handler>();
+    // Anything other than a xen_vcpu_config gets the build's configuration.
+    auto &&passed = dynamic_cast<xen_vcpu_config *>(data);
+    auto &&config = passed != nullptr ? *passed : g_build_config;
+
+    if (!g_domain) {
+        auto nr_vcpus = config.nr_vcpus != 0 ? config.nr_vcpus : nr_cpus();
+
+        g_domain = std::make_unique<xen_domain>(config.domain);
+        g_domain->set_preemption_timer_rate(vmx_preemption_timer_rate());
+
+        if (x2apic_enabled())
+            g_domain->set_kick(x2apic_send_nmi);
+
+        g_domain->prewarm(nr_vcpus);
+        xen_exit_handler::reserve(nr_vcpus);
+    }
+
+    auto &&my_exit_handler = make_xen_exit_handler(vcpuid, g_domain.get(), config.features);
 
-    (void) data;
     return std::make_unique<vcpu_intel_x64>(
                vcpuid,
                nullptr,                         // default debug_ring
@@ -34,7 +34,7 @@ static int __init driver_start(void)
     }
 
     printk(KERN_INFO "Bareflank is running\n");
-    wrmsrl(0x40000000, (long)hypercall_page);
+    wrmsrl(0x40000000, __pa(hypercall_page));
 
     /* Check if hypercall_page was populated by Bareflank */
 
@@ -0,0 +1,479 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/gfp.h>
+
+#include <asm/xen/hypercall.h>
+#include <asm/processor.h>
+#include <asm/msr.h>
+#include <stdbool.h>
+#include <xen/interface/xen.h>
+#include <xen/interface/memory.h>
+#include <xen/interface/event_channel.h>
+
+MODULE_LICENSE("GPL");
+
+/*
+ * Hypercall round-trip benchmark. Writing to /sys/kernel/debug/hcbench/run
+ * starts a run, and /sys/kernel/debug/hcbench/results shows the last one.
+ *
+ * Every bench is run on each CPU alone ("solo"), one CPU after the other,
+ * and then on all CPUs at once ("all"), with every CPU starting each bench
+ * together. Latencies are per call, in cycles; the "all" phase also
+ * reports the aggregate throughput of all CPUs.
+ */
+
+static unsigned long iterations = 1000000;
+module_param(iterations, ulong, 0644);
+MODULE_PARM_DESC(iterations, "calls per bench per CPU");
+
+// Calls made with interrupts off between two chances to take them.
+#define CALLS_PER_IRQ_WINDOW 256
+
+// Latencies up to this many cycles are binned exactly; longer ones are
+// counted as outliers and only contribute to the maximum.
+#define HIST_CYCLES 16384
+
+enum {
+    BENCH_CPUID,
+    BENCH_NULL,
+    BENCH_ENOSYS,
+    BENCH_EVTCHN_SEND,
+    BENCH_CLEAR_PAGE,
+    BENCH_BALLOON,
+    NR_BENCHES
+};
+
+static const char *bench_names[NR_BENCHES] = {
+    "cpuid",
+    "mmuext_op_null",
+    "memory_op_enosys",
+    "event_channel_op_send",
+    "mmuext_op_clear_page",
+    "memory_op_balloon",
+};
+
+enum { PHASE_SOLO, PHASE_ALL, NR_PHASES };
+
+static const char *phase_names[NR_PHASES] = { "solo", "all" };
+
+struct hc_stats {
+    u64 calls;
+    u64 min, p50, p99, p999, max;
+    u64 outliers;
+    u64 start_ns, end_ns;
+};
+
+struct hc_cpu {
+    int cpu;
+    int phase;
+    u32 *hist;
+    struct page *page;
+    evtchn_port_t port;
+    struct completion done;
+    struct hc_stats stats[NR_PHASES][NR_BENCHES];
+};
+
+static struct dentry *hcbench_dir;
+static DEFINE_MUTEX(hcbench_mutex);
+
+static struct hc_cpu *cpus;
+static int nr_cpus;
+static atomic_t barrier;
+static u64 throughput[NR_BENCHES];
+static bool have_results;
+
+static void hc_barrier(int generation)
+{
+    atomic_inc(&barrier);
+
+    while (atomic_read(&barrier) < generation * nr_cpus)
+        cpu_relax();
+}
+
+static long do_call(struct hc_cpu *c, int bench)
+{
+    unsigned int eax, ebx, ecx, edx;
+    struct mmuext_op op;
+    struct evtchn_send send;
+    struct xen_memory_reservation reservation = {
+        .nr_extents = 1,
+        .extent_order = 0,
+        .domid = DOMID_SELF,
+    };
+    xen_pfn_t pfn = page_to_pfn(c->page);
+    long ret;
+
+    switch (bench) {
+    case BENCH_CPUID:
+        cpuid(0x40000000, &eax, &ebx, &ecx, &edx);
+        return 0;
+
+    case BENCH_NULL:
+        return HYPERVISOR_mmuext_op(NULL, 0, NULL, DOMID_SELF);
+
+    case BENCH_ENOSYS:
+        return HYPERVISOR_memory_op(0x3f, NULL) == -ENOSYS ? 0 : -EINVAL;
+
+    case BENCH_EVTCHN_SEND:
+        send.port = c->port;
+        return HYPERVISOR_event_channel_op(EVTCHNOP_send, &send);
+
+    case BENCH_CLEAR_PAGE:
+        op.cmd = MMUEXT_CLEAR_PAGE;
+        op.arg1.mfn = pfn;
+        return HYPERVISOR_mmuext_op(&op, 1, NULL, DOMID_SELF);
+
+    case BENCH_BALLOON:
+        set_xen_guest_handle(reservation.extent_start, &pfn);
+        ret = HYPERVISOR_memory_op(XENMEM_decrease_reservation, &reservation);
+        if (ret != 1)
+            return ret < 0 ? ret : -EIO;
+        ret = HYPERVISOR_memory_op(XENMEM_populate_physmap, &reservation);
+        return ret == 1 ? 0 : (ret < 0 ? ret : -EIO);
+    }
+
+    return -EINVAL;
+}
+
+// bp is the percentile in hundredths of a percent (9990 is p99.9).
+static u64 percentile(const u32 *hist, u64 calls, u64 bp)
+{
+    u64 rank = div64_u64(calls * bp + 9999, 10000);
+    u64 seen = 0;
+    int i;
+
+    for (i = 0; i < HIST_CYCLES; i++) {
+        seen += hist[i];
+        if (seen >= rank && rank != 0)
+            return i;
+    }
+
+    return HIST_CYCLES;
+}
+
+static void run_bench(struct hc_cpu *c, int bench, struct hc_stats *s)
+{
+    unsigned long flags, i, j;
+    u64 start, cycles;
+
+    memset(c->hist, 0, HIST_CYCLES * sizeof(u32));
+    memset(s, 0, sizeof(*s));
+    s->min = ~0ULL;
+    s->start_ns = ktime_get_ns();
+
+    for (i = 0; i < iterations; i += CALLS_PER_IRQ_WINDOW) {
+        local_irq_save(flags);
+
+        for (j = i; j < iterations && j < i + CALLS_PER_IRQ_WINDOW; j++) {
+            start = rdtsc_ordered();
+
+            if (do_call(c, bench) != 0) {
+                local_irq_restore(flags);
+                goto out;
+            }
+
+            cycles = rdtsc_ordered() - start;
+
+            s->calls++;
+            s->min = min(s->min, cycles);
+            s->max = max(s->max, cycles);
+
+            if (cycles < HIST_CYCLES)
+                c->hist[cycles]++;
+            else
+                s->outliers++;
+        }
+
+        local_irq_restore(flags);
+        cond_resched();
+    }
+
+out:
+    s->end_ns = ktime_get_ns();
+
+    if (s->calls == 0) {
+        s->min = 0;
+        return;
+    }
+
+    s->p50 = percentile(c->hist, s->calls, 5000);
+    s->p99 = percentile(c->hist, s->calls, 9900);
+    s->p999 = percentile(c->hist, s->calls, 9990);
+}
+
+static int bench_thread(void *data)
+{
+    struct hc_cpu *c = data;
+    int bench;
+
+    for (bench = 0; bench < NR_BENCHES; bench++) {
+        if (c->phase == PHASE_ALL)
+            hc_barrier(bench + 1);
+
+        run_bench(c, bench, &c->stats[c->phase][bench]);
+    }
+
+    complete(&c->done);
+    return 0;
+}
+
+static struct task_struct *create_thread(struct hc_cpu *c, int phase)
+{
+    struct task_struct *task;
+
+    c->phase = phase;
+    reinit_completion(&c->done);
+
+    task = kthread_create(bench_thread, c, "hcbench/%d", c->cpu);
+    if (!IS_ERR(task))
+        kthread_bind(task, c->cpu);
+
+    return task;
+}
+
+static void free_cpus(void)
+{
+    struct evtchn_close close;
+    int i;
+
+    if (cpus == NULL)
+        return;
+
+    for (i = 0; i < nr_cpus; i++) {
+        if (cpus[i].port != 0) {
+            close.port = cpus[i].port;
+            HYPERVISOR_event_channel_op(EVTCHNOP_close, &close);
+        }
+        if (cpus[i].page)
+            __free_page(cpus[i].page);
+        vfree(cpus[i].hist);
+    }
+
+    kfree(cpus);
+    cpus = NULL;
+}
+
+static int alloc_cpus(void)
+{
+    struct evtchn_bind_ipi bind;
+    int cpu, i = 0;
+
+    nr_cpus = num_online_cpus();
+    cpus = kcalloc(nr_cpus, sizeof(*cpus), GFP_KERNEL);
+    if (cpus == NULL)
+        return -ENOMEM;
+
+    for_each_online_cpu(cpu) {
+        struct hc_cpu *c;
+
+        if (i == nr_cpus)
+            break;
+
+        c = &cpus[i++];
+
+        c->cpu = cpu;
+        init_completion(&c->done);
+
+        c->hist = vzalloc(HIST_CYCLES * sizeof(u32));
+        c->page = alloc_page(GFP_KERNEL);
+        if (c->hist == NULL || c->page == NULL)
+            return -ENOMEM;
+
+        bind.vcpu = cpu;
+        if (HYPERVISOR_event_channel_op(EVTCHNOP_bind_ipi, &bind) == 0)
+            c->port = bind.port;
+    }
+
+    nr_cpus = i;
+    return 0;
+}
+
+static int run_all(void)
+{
+    struct task_struct **tasks;
+    u64 calls, start, end;
+    int i, bench, ret;
+
+    ret = alloc_cpus();
+    if (ret != 0)
+        return ret;
+
+    tasks = kcalloc(nr_cpus, sizeof(*tasks), GFP_KERNEL);
+    if (tasks == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < nr_cpus; i++) {
+        tasks[i] = create_thread(&cpus[i], PHASE_SOLO);
+        if (IS_ERR(tasks[i])) {
+            ret = PTR_ERR(tasks[i]);
+            goto out;
+        }
+
+        wake_up_process(tasks[i]);
+        wait_for_completion(&cpus[i].done);
+    }
+
+    // Every thread is created before any is woken, so that a failure
+    // cannot leave the others waiting at the barrier.
+    for (i = 0; i < nr_cpus; i++) {
+        tasks[i] = create_thread(&cpus[i], PHASE_ALL);
+        if (IS_ERR(tasks[i])) {
+            ret = PTR_ERR(tasks[i]);
+            while (i-- > 0)
+                kthread_stop(tasks[i]);
+            goto out;
+        }
+    }
+
+    atomic_set(&barrier, 0);
+
+    for (i = 0; i < nr_cpus; i++)
+        wake_up_process(tasks[i]);
+
+    for (i = 0; i < nr_cpus; i++)
+        wait_for_completion(&cpus[i].done);
+
+    for (bench = 0; bench < NR_BENCHES; bench++) {
+        calls = 0;
+        start = ~0ULL;
+        end = 0;
+
+        for (i = 0; i < nr_cpus; i++) {
+            struct hc_stats *s = &cpus[i].stats[PHASE_ALL][bench];
+
+            calls += s->calls;
+            start = min(start, s->start_ns);
+            end = max(end, s->end_ns);
+        }
+
+        throughput[bench] = end > start ? div64_u64(calls * NSEC_PER_SEC, end - start) : 0;
+    }
+
+    have_results = true;
+
+out:
+    kfree(tasks);
+    return ret;
+}
+
+static int results_show(struct seq_file *m, void *v)
+{
+    int phase, bench, i;
+
+    mutex_lock(&hcbench_mutex);
+
+    if (!have_results) {
+        seq_printf(m, "no results: write to run first\n");
+        goto out;
+    }
+
+    seq_printf(m, "phase bench cpu calls min p50 p99 p99.9 max outliers\n");
+
+    for (phase = 0; phase < NR_PHASES; phase++) {
+        for (bench = 0; bench < NR_BENCHES; bench++) {
+            for (i = 0; i < nr_cpus; i++) {
+                struct hc_stats *s = &cpus[i].stats[phase][bench];
+
+                seq_printf(m, "%s %s %d %llu %llu %llu %llu %llu %llu %llu\n",
+                           phase_names[phase], bench_names[bench], cpus[i].cpu,
+                           s->calls, s->min, s->p50, s->p99, s->p999, s->max,
+                           s->outliers);
+            }
+        }
+    }
+
+    seq_printf(m, "\nbench aggregate_calls_per_sec\n");
+
+    for (bench = 0; bench < NR_BENCHES; bench++)
+        seq_printf(m, "%s %llu\n", bench_names[bench], throughput[bench]);
+
+out:
+    mutex_unlock(&hcbench_mutex);
+    return 0;
+}
+
+static int results_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, results_show, NULL);
+}
+
+static const struct file_operations results_fops = {
+    .owner = THIS_MODULE,
+    .open = results_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static ssize_t run_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+    int ret;
+
+    mutex_lock(&hcbench_mutex);
+
+    free_cpus();
+    have_results = false;
+
+    printk(KERN_INFO "[HCBENCH]: running %lu calls per bench per cpu\n", iterations);
+    ret = run_all();
+    printk(KERN_INFO "[HCBENCH]: done (%d)\n", ret);
+
+    mutex_unlock(&hcbench_mutex);
+
+    return ret == 0 ? count : ret;
+}
+
+static const struct file_operations run_fops = {
+    .owner = THIS_MODULE,
+    .write = run_write,
+};
+
+bool bareflank_is_running(void)
+{
+    if (hypervisor_cpuid_base("XenVMMXenVMM", 2) == 0) {
+        printk(KERN_ERR "[HCBENCH]: Bareflank is not running. Aborting.\n");
+        return false;
+    }
+    return true;
+}
+
+static int __init driver_start(void)
+{
+    if (bareflank_is_running() == false)
+        goto abort;
+
+    wrmsrl(0x40000000, __pa(hypercall_page));
+
+    if (*(uint64_t *)hypercall_page == 0) {
+        printk(KERN_ERR "[HCBENCH]: hypercall_page was not populated. Aborting.\n");
+        goto abort;
+    }
+
+    hcbench_dir = debugfs_create_dir("hcbench", NULL);
+    debugfs_create_file("run", 0200, hcbench_dir, NULL, &run_fops);
+    debugfs_create_file("results", 0444, hcbench_dir, NULL, &results_fops);
+
+ abort:
+    return 0;
+}
+
+static void __exit driver_end(void)
+{
+    debugfs_remove_recursive(hcbench_dir);
+
+    mutex_lock(&hcbench_mutex);
+    free_cpus();
+    mutex_unlock(&hcbench_mutex);
+}
+
+module_init(driver_start);
+module_exit(driver_end);
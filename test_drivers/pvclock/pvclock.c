@@ -8,6 +8,7 @@
 #include <asm/processor.h>
 #include <stdbool.h>
 #include <xen/interface/xen.h>
+#include <xen/interface/memory.h>
 #include <linux/time.h>
 #include <linux/delay.h>
 #include <linux/mutex.h>
@@ -31,65 +32,6 @@ spinlock_t lock;
 
 
 
-/**
- * COPIED FROM LINUX KERNEL: kernel/time/clocksource.c
- * clocks_calc_mult_shift - calculate mult/shift factors for scaled math of clocks
- * @mult:	pointer to mult variable
- * @shift:	pointer to shift variable
- * @from:	frequency to convert from
- * @to:		frequency to convert to
- * @maxsec:	guaranteed runtime conversion range in seconds
- *
- * The function evaluates the shift/mult pair for the scaled math
- * operations of clocksources and clockevents.
- *
- * @to and @from are frequency values in HZ. For clock sources @to is
- * NSEC_PER_SEC == 1GHz and @from is the counter frequency. For clock
- * event @to is the counter frequency and @from is NSEC_PER_SEC.
- *
- * The @maxsec conversion range argument controls the time frame in
- * seconds which must be covered by the runtime conversion with the
- * calculated mult and shift factors. This guarantees that no 64bit
- * overflow happens when the input value of the conversion is
- * multiplied with the calculated mult factor. Larger ranges may
- * reduce the conversion accuracy by chosing smaller mult and shift
- * factors.
- */
-void
-clocks_calc_mult_shift(u32 *mult, u32 *shift, u32 from, u32 to, u32 maxsec)
-{
-    u64 tmp;
-    u32 sft, sftacc= 32;
-
-    /*
-     * Calculate the shift factor which is limiting the conversion
-     * range:
-     */
-    tmp = ((u64)maxsec * from) >> 32;
-    while (tmp) {
-        tmp >>=1;
-        sftacc--;
-    }
-
-    /*
-     * Find the conversion shift/mult pair which has the best
-     * accuracy and fits the maxsec conversion range:
-     */
-    for (sft = 32; sft > 0; sft--) {
-        tmp = (u64) to << sft;
-        tmp += from / 2;
-        do_div(tmp, from);
-        if ((tmp >> sftacc) == 0)
-            break;
-    }
-    *mult = tmp;
-    *shift = sft;
-}
-
-
-
-
-
 inline void make_hypercall0(unsigned long rax)
 {
     asm volatile (
@@ -110,14 +52,15 @@ inline void make_hypercall1(unsigned long rax, unsigned long rdi)
                   );
 }
 
-inline void make_hypercall2(unsigned long rax, unsigned long rdi, unsigned long rsi)
+inline long make_hypercall2(unsigned long rax, unsigned long rdi, unsigned long rsi)
 {
     asm volatile (
                   "vmcall\n\t"
-                  :
-                  :  "a" (rax), "D" (rdi), "S" (rsi)
+                  : "+a" (rax)
+                  :  "D" (rdi), "S" (rsi)
                   : "memory"
                   );
+    return (long)rax;
 }
 inline void make_hypercall3(unsigned long rax, unsigned long rdi,
                             unsigned long rsi, unsigned long rdx)
@@ -176,45 +119,63 @@ bool bareflank_is_running(void)
 
 }
 
-bool init_shared_info(void)
+bool init_start_info(void)
 {
-    uint32_t mult, shift;
+    printk(KERN_INFO "[PVCLOCK]: initializing start_info page\n");
 
-    printk(KERN_INFO "[PVCLOCK]: initializing shared_info page.\n");
-    shared_info = kzalloc(sizeof(struct shared_info), GFP_KERNEL);
+    start_info = kzalloc(sizeof(struct start_info), GFP_KERNEL);
 
-    if (shared_info == NULL) {
-        printk(KERN_ERR "[PVCLOCK]: shared_info is NULL. Aborting.\n");
+    if (start_info == NULL) {
+        printk(KERN_ERR "[PVCLOCK]: start_info is NULL. Aborting.\n");
         return false;
     }
 
-    clocks_calc_mult_shift(&mult, &shift, tsc_khz, NSEC_PER_MSEC, 0);
+    make_hypercall1(INIT_START_INFO, (unsigned long)start_info);
+
+    if (strncmp(start_info->magic, "xen-", 4)) {
+        printk(KERN_ERR "[PVCLOCK]: failed to initialize start_info page. Aborting.\n");
+        return false;
+    }
 
-    shared_info->vcpu_info[0].time.tsc_to_system_mul = mult;
-    shared_info->vcpu_info[0].time.tsc_shift = (uint8_t)shift;
+    printk(KERN_INFO "[PVCLOCK]: %s: nr_pages=%lu shared_info=0x%lx flags=0x%x\n",
+           start_info->magic, start_info->nr_pages, start_info->shared_info,
+           start_info->flags);
+    printk(KERN_INFO "[PVCLOCK]: store mfn=0x%lx evtchn=%u console mfn=0x%lx evtchn=%u\n",
+           (unsigned long)start_info->store_mfn, start_info->store_evtchn,
+           (unsigned long)start_info->console.domU.mfn, start_info->console.domU.evtchn);
 
-    make_hypercall2(INIT_SHARED_INFO, (unsigned long)shared_info, tsc_khz);
     return true;
 }
 
-bool init_start_info(void)
+bool init_shared_info(void)
 {
-    printk(KERN_INFO "[PVCLOCK]: initializing start_info page\n");
+    struct xen_add_to_physmap xatp;
 
-    start_info = kzalloc(sizeof(struct start_info), GFP_KERNEL);
+    printk(KERN_INFO "[PVCLOCK]: placing shared_info page.\n");
+    shared_info = (struct shared_info *)get_zeroed_page(GFP_KERNEL);
 
-    if (start_info == NULL) {
-        printk(KERN_ERR "[PVCLOCK]: start_info is NULL. Aborting.\n");
+    if (shared_info == NULL) {
+        printk(KERN_ERR "[PVCLOCK]: shared_info is NULL. Aborting.\n");
         return false;
     }
 
-    make_hypercall1(INIT_START_INFO, (unsigned long)start_info);
+    xatp.domid = DOMID_SELF;
+    xatp.idx = 0;
+    xatp.space = XENMAPSPACE_shared_info;
+    xatp.gpfn = virt_to_phys(shared_info) >> PAGE_SHIFT;
 
-    if (strcmp(start_info->magic, "xen-TEST-TEST")) {
-        printk(KERN_ERR "[PVCLOCK]: failed to initialize start_info page. Aborting.\n");
+    if (make_hypercall2(__HYPERVISOR_memory_op, XENMEM_add_to_physmap,
+                        (unsigned long)&xatp) != 0) {
+        printk(KERN_ERR "[PVCLOCK]: XENMEM_add_to_physmap failed. Aborting.\n");
+        free_page((unsigned long)shared_info);
+        shared_info = NULL;
         return false;
     }
 
+    printk(KERN_INFO "[PVCLOCK]: tsc_to_system_mul=0x%x tsc_shift=%d\n",
+           shared_info->vcpu_info[0].time.tsc_to_system_mul,
+           shared_info->vcpu_info[0].time.tsc_shift);
+
     return true;
 }
 
@@ -228,22 +189,49 @@ static int __init driver_start(void)
     if (bareflank_is_running() == false)
         goto abort;
 
+    if (init_start_info() == false)
+        goto abort;
+
     if (init_shared_info() == false)
         goto abort;
 
     set_bareflank_time();
     elapsed_time_thread = kthread_run(print_elapsed_time, NULL, "print_elapsed_time");
 
-    if (init_start_info() == false)
-        goto abort;
-
  abort:
     return 0;
 }
 
+/*
+ * The hypervisor writes to shared_info for as long as it is placed, so it
+ * is handed back before the page is freed. If that fails the page is
+ * leaked rather than freed under the hypervisor.
+ */
+void fini_shared_info(void)
+{
+    struct xen_remove_from_physmap xrfp;
+
+    xrfp.domid = DOMID_SELF;
+    xrfp.gpfn = virt_to_phys(shared_info) >> PAGE_SHIFT;
+
+    if (make_hypercall2(__HYPERVISOR_memory_op, XENMEM_remove_from_physmap,
+                        (unsigned long)&xrfp) != 0) {
+        printk(KERN_ERR "[PVCLOCK]: XENMEM_remove_from_physmap failed. Leaking shared_info.\n");
+        return;
+    }
+
+    free_page((unsigned long)shared_info);
+}
+
 static void __exit driver_end(void)
 {
-    kthread_stop(elapsed_time_thread);
+    if (elapsed_time_thread)
+        kthread_stop(elapsed_time_thread);
+
+    if (shared_info)
+        fini_shared_info();
+
+    kfree(start_info);
 }
 
 
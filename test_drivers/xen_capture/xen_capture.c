@@ -0,0 +1,130 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include <asm/processor.h>
+#include <asm/xen/hypervisor.h>
+#include <stdbool.h>
+#include <../../include/exit_handler/test_hypercalls.h>
+
+MODULE_LICENSE("GPL");
+
+/*
+ * Exposes the hypervisor's exit capture (built with XEN_EXIT_CAPTURE) in
+ * debugfs. Writing "start" or "stop" to xen_capture/control starts or stops
+ * capturing on all vCPUs; once stopped, xen_capture/vcpuN reads vCPU N's
+ * log, ready for xen_exit_replay:
+ *
+ *     echo start > /sys/kernel/debug/xen_capture/control
+ *     ... run the workload ...
+ *     echo stop > /sys/kernel/debug/xen_capture/control
+ *     cat /sys/kernel/debug/xen_capture/vcpu* > capture.log
+ */
+
+static struct dentry *capture_dir;
+
+static inline long capture_op(unsigned long op, unsigned long vcpu, unsigned long offset,
+                              void *buf, unsigned long len)
+{
+    unsigned long rax = CAPTURE_OP;
+    register unsigned long r10 asm("r10") = (unsigned long)buf;
+    register unsigned long r8 asm("r8") = len;
+
+    asm volatile (
+                  "vmcall\n\t"
+                  : "+a" (rax), "+D" (op), "+S" (vcpu), "+d" (offset), "+r" (r10), "+r" (r8)
+                  :
+                  : "memory"
+                  );
+    return (long)op;
+}
+
+static ssize_t control_write(struct file *file, const char __user *ubuf, size_t count,
+                             loff_t *ppos)
+{
+    char cmd[8] = { 0 };
+
+    if (copy_from_user(cmd, ubuf, min(count, sizeof(cmd) - 1)))
+        return -EFAULT;
+
+    if (sysfs_streq(cmd, "start"))
+        capture_op(CAPTURE_OP_START, 0, 0, NULL, 0);
+    else if (sysfs_streq(cmd, "stop"))
+        capture_op(CAPTURE_OP_STOP, 0, 0, NULL, 0);
+    else
+        return -EINVAL;
+
+    return count;
+}
+
+static ssize_t vcpu_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos)
+{
+    unsigned long vcpu = (unsigned long)file->private_data;
+    void *buf;
+    long ret;
+
+    buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    if (buf == NULL)
+        return -ENOMEM;
+
+    ret = capture_op(CAPTURE_OP_READ, vcpu, *ppos, buf, min_t(size_t, count, PAGE_SIZE));
+
+    if (ret > 0) {
+        if (copy_to_user(ubuf, buf, ret))
+            ret = -EFAULT;
+        else
+            *ppos += ret;
+    }
+
+    kfree(buf);
+    return ret;
+}
+
+static const struct file_operations control_fops = {
+    .owner = THIS_MODULE,
+    .write = control_write,
+};
+
+static const struct file_operations vcpu_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .read = vcpu_read,
+};
+
+bool bareflank_is_running(void)
+{
+    if (hypervisor_cpuid_base("XenVMMXenVMM", 2) == 0) {
+        printk(KERN_ERR "[XEN_CAPTURE]: Bareflank is not running. Aborting.\n");
+        return false;
+    }
+    return true;
+}
+
+static int __init driver_start(void)
+{
+    char name[16];
+    unsigned long cpu;
+
+    if (bareflank_is_running() == false)
+        return 0;
+
+    capture_dir = debugfs_create_dir("xen_capture", NULL);
+    debugfs_create_file("control", 0200, capture_dir, NULL, &control_fops);
+
+    for_each_possible_cpu(cpu) {
+        snprintf(name, sizeof(name), "vcpu%lu", cpu);
+        debugfs_create_file(name, 0400, capture_dir, (void *)cpu, &vcpu_fops);
+    }
+
+    return 0;
+}
+
+static void __exit driver_end(void)
+{
+    debugfs_remove_recursive(capture_dir);
+}
+
+module_init(driver_start);
+module_exit(driver_end);
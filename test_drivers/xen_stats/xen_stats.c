@@ -0,0 +1,140 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/io.h>
+
+#include <asm/processor.h>
+#include <asm/xen/hypervisor.h>
+#include <stdbool.h>
+#include <../../include/exit_handler/test_hypercalls.h>
+#include <../../include/exit_handler/xen_stats_page.h>
+
+MODULE_LICENSE("GPL");
+
+static struct xen_stats_page *stats_page;
+static struct dentry *stats_file;
+
+static inline unsigned long make_hypercall_ret1(unsigned long rax)
+{
+    unsigned long rdi = 0;
+
+    asm volatile (
+                  "vmcall\n\t"
+                  : "+a" (rax), "+D" (rdi)
+                  :
+                  : "memory"
+                  );
+    return rdi;
+}
+
+/*
+ * Takes a consistent snapshot of one vCPU's counters without exiting to
+ * the hypervisor; see xen_stats_page.h.
+ */
+static void read_vcpu_stats(const struct xen_stats_vcpu *entry, struct xen_stats_vcpu *copy)
+{
+    uint32_t seq;
+
+    do {
+        seq = READ_ONCE(entry->seq);
+        smp_rmb();
+        memcpy(copy, entry, sizeof(*copy));
+        smp_rmb();
+    } while ((seq & 1) || seq != READ_ONCE(entry->seq));
+}
+
+static int stats_show(struct seq_file *m, void *v)
+{
+    struct xen_stats_vcpu copy;
+    uint32_t i, nr_vcpus;
+
+    nr_vcpus = min_t(uint32_t, READ_ONCE(stats_page->nr_vcpus), XEN_STATS_PAGE_VCPUS);
+
+    seq_printf(m, "vcpu exits hypercalls event_sends time_updates blocks wakeups wake_latency_ns\n");
+
+    for (i = 0; i < nr_vcpus; i++) {
+        read_vcpu_stats(&stats_page->vcpu[i], &copy);
+        seq_printf(m, "%u %llu %llu %llu %llu %llu %llu %llu\n", i,
+                   (unsigned long long)copy.exits,
+                   (unsigned long long)copy.hypercalls,
+                   (unsigned long long)copy.event_sends,
+                   (unsigned long long)copy.time_updates,
+                   (unsigned long long)copy.blocks,
+                   (unsigned long long)copy.wakeups,
+                   (unsigned long long)copy.wake_latency_ns);
+    }
+
+    return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, stats_show, NULL);
+}
+
+static const struct file_operations stats_fops = {
+    .owner = THIS_MODULE,
+    .open = stats_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+bool bareflank_is_running(void)
+{
+    if (hypervisor_cpuid_base("XenVMMXenVMM", 2) == 0) {
+        printk(KERN_ERR "[XEN_STATS]: Bareflank is not running. Aborting.\n");
+        return false;
+    }
+    return true;
+}
+
+static int __init driver_start(void)
+{
+    unsigned long maddr;
+
+    if (bareflank_is_running() == false)
+        goto abort;
+
+    /* The only vmcall this driver makes: everything after is exit-free. */
+    maddr = make_hypercall_ret1(GET_STATS_PAGE);
+
+    if (maddr == 0) {
+        printk(KERN_ERR "[XEN_STATS]: no statistics page. Aborting.\n");
+        goto abort;
+    }
+
+    stats_page = memremap(maddr, PAGE_SIZE, MEMREMAP_WB);
+
+    if (stats_page == NULL || stats_page->magic != XEN_STATS_PAGE_MAGIC) {
+        printk(KERN_ERR "[XEN_STATS]: failed to map the statistics page. Aborting.\n");
+        goto unmap;
+    }
+
+    stats_file = debugfs_create_file("xen_stats", 0444, NULL, NULL, &stats_fops);
+
+    printk(KERN_INFO "[XEN_STATS]: statistics page v%u at 0x%lx, %u vcpu(s)\n",
+           stats_page->version, maddr, stats_page->nr_vcpus);
+
+    return 0;
+
+ unmap:
+    if (stats_page)
+        memunmap(stats_page);
+    stats_page = NULL;
+
+ abort:
+    return 0;
+}
+
+static void __exit driver_end(void)
+{
+    debugfs_remove(stats_file);
+
+    if (stats_page)
+        memunmap(stats_page);
+}
+
+module_init(driver_start);
+module_exit(driver_end);
@@ -0,0 +1,168 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/io.h>
+#include <linux/smp.h>
+
+#include <asm/xen/hypercall.h>
+#include <asm/processor.h>
+#include <stdbool.h>
+#include <xen/interface/xen.h>
+#include <xen/interface/xenoprof.h>
+
+MODULE_LICENSE("GPL");
+
+/*
+ * Guest side of the hypervisor's timer-driven sampling profiler. Writing a
+ * period in TSC cycles to /sys/kernel/debug/xenoprof/start starts sampling
+ * every CPU at that period, and writing anything to .../stop stops it.
+ * Reading .../samples drains every CPU's buffer as "cpu mode rip" lines
+ * (mode 0 is user, 1 kernel); resolve the addresses with the guest's
+ * System.map or perf's tooling.
+ */
+
+static struct xenoprof_buf *bufs[NR_CPUS];
+static struct dentry *oprof_dir;
+
+static inline int xenoprof_op(unsigned int op, void *arg)
+{
+    return _hypercall2(int, xenoprof_op, op, arg);
+}
+
+static void get_buffer(void *info)
+{
+    struct xenoprof_get_buffer get = { .max_samples = 0 };
+    int cpu = smp_processor_id();
+
+    if (xenoprof_op(XENOPROF_get_buffer, &get) != 0)
+        return;
+
+    bufs[cpu] = memremap(get.buf_gmaddr, get.bufsize, MEMREMAP_WB);
+}
+
+static ssize_t start_write(struct file *file, const char __user *ubuf, size_t count,
+                           loff_t *ppos)
+{
+    struct xenoprof_counter counter = { .ind = 0, .enabled = 1 };
+    int ret;
+
+    ret = kstrtou64_from_user(ubuf, count, 0, &counter.count);
+    if (ret)
+        return ret;
+
+    ret = xenoprof_op(XENOPROF_counter, &counter);
+    if (ret == 0)
+        ret = xenoprof_op(XENOPROF_start, NULL);
+
+    return ret ? ret : count;
+}
+
+static ssize_t stop_write(struct file *file, const char __user *ubuf, size_t count,
+                          loff_t *ppos)
+{
+    xenoprof_op(XENOPROF_stop, NULL);
+    return count;
+}
+
+static int samples_show(struct seq_file *m, void *v)
+{
+    struct xenoprof_buf *buf;
+    uint32_t head, tail;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        buf = bufs[cpu];
+        if (buf == NULL)
+            continue;
+
+        head = smp_load_acquire(&buf->event_head);
+        tail = buf->event_tail;
+
+        while (tail != head) {
+            seq_printf(m, "%d %u 0x%llx\n", cpu, buf->event_log[tail].mode,
+                       (unsigned long long)buf->event_log[tail].eip);
+
+            if (++tail == buf->event_size)
+                tail = 0;
+        }
+
+        smp_store_release(&buf->event_tail, tail);
+    }
+
+    return 0;
+}
+
+static int samples_open(struct inode *inode, struct file *file)
+{
+    return single_open_size(file, samples_show, NULL, 1 << 20);
+}
+
+static const struct file_operations start_fops = {
+    .owner = THIS_MODULE,
+    .write = start_write,
+};
+
+static const struct file_operations stop_fops = {
+    .owner = THIS_MODULE,
+    .write = stop_write,
+};
+
+static const struct file_operations samples_fops = {
+    .owner = THIS_MODULE,
+    .open = samples_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+bool bareflank_is_running(void)
+{
+    if (hypervisor_cpuid_base("XenVMMXenVMM", 2) == 0) {
+        printk(KERN_ERR "[XENOPROF]: Bareflank is not running. Aborting.\n");
+        return false;
+    }
+    return true;
+}
+
+static int __init driver_start(void)
+{
+    struct xenoprof_init init = { .num_events = 0 };
+    int cpu;
+
+    if (bareflank_is_running() == false)
+        return 0;
+
+    if (xenoprof_op(XENOPROF_init, &init) != 0) {
+        printk(KERN_ERR "[XENOPROF]: xenoprof_op not supported. Aborting.\n");
+        return 0;
+    }
+
+    for_each_online_cpu(cpu)
+        smp_call_function_single(cpu, get_buffer, NULL, 1);
+
+    oprof_dir = debugfs_create_dir("xenoprof", NULL);
+    debugfs_create_file("start", 0200, oprof_dir, NULL, &start_fops);
+    debugfs_create_file("stop", 0200, oprof_dir, NULL, &stop_fops);
+    debugfs_create_file("samples", 0400, oprof_dir, NULL, &samples_fops);
+
+    printk(KERN_INFO "[XENOPROF]: cpu type %s\n", init.cpu_type);
+    return 0;
+}
+
+static void __exit driver_end(void)
+{
+    int cpu;
+
+    xenoprof_op(XENOPROF_shutdown, NULL);
+    debugfs_remove_recursive(oprof_dir);
+
+    for_each_possible_cpu(cpu) {
+        if (bufs[cpu])
+            memunmap(bufs[cpu]);
+    }
+}
+
+module_init(driver_start);
+module_exit(driver_end);